@@ -0,0 +1,151 @@
+#!/usr/bin/python3
+from __future__ import annotations
+from typing import Dict, List, Optional
+
+import sys
+
+if sys.version_info < (3, 7):
+    raise Exception("python>=3.7 is required")
+
+import os
+import os.path
+import json
+import time
+import shlex
+import argparse
+import subprocess
+import logging
+
+
+logging.basicConfig(
+    level=os.getenv("LOG_LEVEL", "INFO"),
+    format="%(message)s",
+)
+
+logger = logging.getLogger("bench")
+
+
+# Exit codes above that mean the run itself failed, 1 is just "no matches"
+MAX_OK_RETURNCODE = 1
+
+
+def command_name(workload: List[str]) -> str:
+    return " ".join(shlex.quote(arg) for arg in workload)
+
+
+def input_size(corpus_dir: str, args: List[str]) -> int:
+    size = 0
+    for arg in args:
+        path = os.path.join(corpus_dir, arg)
+        if os.path.isfile(path):
+            size += os.path.getsize(path)
+        elif os.path.isdir(path):
+            for root, _, files in os.walk(path):
+                size += sum(os.path.getsize(os.path.join(root, f)) for f in files)
+    return size
+
+
+def run_workload(
+    bins: Dict[str, str], corpus_dir: str, workload: List[str], runs: int
+) -> Optional[float]:
+    """
+    :returns: Best throughput of `runs` runs in MB/s or None if it failed
+    """
+    command = [bins[workload[0]]] + workload[1:]
+    size = input_size(corpus_dir, workload[1:])
+    best = None
+
+    for _ in range(runs):
+        start = time.perf_counter()
+        proc = subprocess.run(
+            command,
+            cwd=corpus_dir,
+            stdout=subprocess.DEVNULL,
+            stderr=subprocess.PIPE,
+        )
+        elapsed = time.perf_counter() - start
+
+        if proc.returncode > MAX_OK_RETURNCODE:
+            logger.error(f"{command_name(workload)}: {proc.stderr.decode()!s}")
+            return None
+
+        best = elapsed if best is None else min(best, elapsed)
+
+    return size / (1 << 20) / best
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(
+        description="Measures throughput of s21_cat and s21_grep workloads"
+    )
+    parser.add_argument("corpus_dir")
+    parser.add_argument("workloads", help="file with one command per line")
+    parser.add_argument("--cat", required=True, help="s21_cat binary")
+    parser.add_argument("--grep", required=True, help="s21_grep binary")
+    parser.add_argument("--runs", type=int, default=5)
+    parser.add_argument(
+        "--train", action="store_true",
+        help="run every workload once and measure nothing (PGO training)",
+    )
+    parser.add_argument("--save", metavar="FILE", help="store results as baseline")
+    parser.add_argument("--check", metavar="FILE", help="compare with baseline")
+    parser.add_argument(
+        "--threshold", type=float, default=10.0,
+        help="allowed slowdown against baseline, in percent",
+    )
+    args = parser.parse_args()
+
+    bins = {
+        "s21_cat": os.path.abspath(args.cat),
+        "s21_grep": os.path.abspath(args.grep),
+    }
+
+    with open(args.workloads) as f:
+        workloads = [shlex.split(line, comments=True) for line in f]
+        workloads = [w for w in workloads if len(w) > 0]
+
+    runs = 1 if args.train else args.runs
+    results: Dict[str, float] = {}
+    failed = False
+
+    for workload in workloads:
+        name = command_name(workload)
+        throughput = run_workload(bins, args.corpus_dir, workload, runs)
+
+        if throughput is None:
+            failed = True
+        elif not args.train:
+            results[name] = throughput
+            logger.info(f"{throughput:10.1f} MB/s  {name}")
+
+    if args.save is not None and not failed:
+        with open(args.save, "w") as f:
+            json.dump({"workloads": results}, f, indent=2)
+        logger.info(f"baseline saved to {args.save}")
+
+    if args.check is not None:
+        if not os.path.exists(args.check):
+            logger.error(f"{args.check}: no baseline, run `make perf-baseline`")
+            return 2
+
+        with open(args.check) as f:
+            baseline: Dict[str, float] = json.load(f)["workloads"]
+
+        logger.info("")
+        for name, base in baseline.items():
+            if name not in results:
+                logger.warning(f"   skipped  {name}")
+                continue
+
+            change = (results[name] / base - 1) * 100
+            isregression = change < -args.threshold
+            failed = failed or isregression
+            logger.info(
+                f"{'REGRESSED' if isregression else 'ok':>10} {change:+6.1f}%  {name}"
+            )
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
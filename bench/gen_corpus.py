@@ -0,0 +1,138 @@
+#!/usr/bin/python3
+from __future__ import annotations
+from typing import Callable, Sequence
+
+import sys
+
+if sys.version_info < (3, 7):
+    raise Exception("python>=3.7 is required")
+
+import os
+import os.path
+import random
+import argparse
+import logging
+
+
+logging.basicConfig(
+    level=os.getenv("LOG_LEVEL", "INFO"),
+    format="%(message)s",
+)
+
+logger = logging.getLogger("gen_corpus")
+
+
+# Same seed gives byte-identical corpus, so numbers from different runs are
+# comparable
+SEED = 21
+
+WORDS = (
+    "lorem ipsum dolor sit amet consectetur adipiscing elit sed do eiusmod "
+    "tempor incididunt ut labore et dolore magna aliqua enim ad minim veniam "
+    "quis nostrud exercitation ullamco laboris nisi aliquip ex ea commodo "
+    "consequat duis aute irure in reprehenderit voluptate velit esse cillum "
+    "fugiat nulla pariatur excepteur sint occaecat cupidatat non proident "
+    "sunt culpa qui officia deserunt mollit anim id est laborum"
+).split()
+
+UTF8_WORDS = (
+    "привет мир строка поиск файл ошибка данные текст "
+    "こんにちは 世界 検索 文字列 "
+    "γειά κόσμος αναζήτηση "
+    "naïve café façade déjà señor"
+).split()
+
+LEVELS = ("DEBUG", "INFO", "INFO", "INFO", "WARN", "ERROR")
+SERVICES = ("auth", "billing", "gateway", "search", "storage", "scheduler")
+
+
+def gen_log_line(rng: random.Random, index: int) -> str:
+    message = " ".join(rng.choices(WORDS, k=rng.randint(4, 14)))
+    return (
+        f"2024-03-{1 + index % 28:02}T{index % 24:02}:{index % 60:02}:"
+        f"{(index * 7) % 60:02}.{index % 1000:03}Z "
+        f"[{rng.choice(LEVELS)}] {rng.choice(SERVICES)}: {message} "
+        f"id={rng.randint(0, 99999)} took {rng.randint(0, 999)}ms\n"
+    )
+
+
+def gen_prose_line(rng: random.Random, words: Sequence[str]) -> str:
+    if rng.random() < 0.1:
+        return "\n"
+    line = " ".join(rng.choices(words, k=rng.randint(1, 20)))
+    if rng.random() < 0.05:
+        line = "\t" + line
+    return line.capitalize() + ".\n"
+
+
+def write_lines(path: str, size: int, gen_line: Callable[[int], str]) -> None:
+    written = 0
+    index = 0
+    with open(path, "w", encoding="utf-8") as f:
+        while written < size:
+            line = gen_line(index)
+            f.write(line)
+            written += len(line.encode("utf-8"))
+            index += 1
+    logger.info(f"{path}: {written} bytes")
+
+
+def write_tree(path: str, rng: random.Random, file_count: int) -> None:
+    names = ("src", "lib", "docs", "tests", "node_modules", "build", "vendor")
+    exts = (".c", ".h", ".txt", ".md", ".o")
+
+    for i in range(file_count):
+        depth = rng.randint(1, 3)
+        dir_path = os.path.join(path, *rng.choices(names, k=depth))
+        os.makedirs(dir_path, exist_ok=True)
+        file_path = os.path.join(dir_path, f"file_{i}{rng.choice(exts)}")
+        with open(file_path, "w") as f:
+            for _ in range(rng.randint(5, 60)):
+                f.write(gen_prose_line(rng, WORDS))
+            if rng.random() < 0.3:
+                f.write("int main(void) { return 0; }\n")
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(
+        description="Generates benchmark corpus for s21_cat and s21_grep"
+    )
+    parser.add_argument("corpus_dir")
+    parser.add_argument(
+        "--size-mb", type=int, default=64, help="size of the main log file"
+    )
+    args = parser.parse_args()
+    corpus_dir: str = args.corpus_dir
+    size = args.size_mb << 20
+
+    rng = random.Random(SEED)
+    os.makedirs(corpus_dir, exist_ok=True)
+
+    write_lines(
+        os.path.join(corpus_dir, "log.txt"), size,
+        lambda i: gen_log_line(rng, i),
+    )
+    write_lines(
+        os.path.join(corpus_dir, "words.txt"), size // 4,
+        lambda i: gen_prose_line(rng, WORDS),
+    )
+    write_lines(
+        os.path.join(corpus_dir, "utf8.txt"), size // 8,
+        lambda i: gen_prose_line(rng, WORDS + UTF8_WORDS),
+    )
+
+    # One huge line, the worst case for line based readers
+    with open(os.path.join(corpus_dir, "longline.txt"), "w") as f:
+        f.write(" ".join(rng.choices(WORDS, k=size // 48)) + "\n")
+
+    with open(os.path.join(corpus_dir, "patterns.txt"), "w") as f:
+        for word in rng.sample(WORDS, 24):
+            f.write(f"{word} {rng.choice(WORDS)}\n")
+
+    write_tree(os.path.join(corpus_dir, "tree"), rng, 2000)
+
+    return 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
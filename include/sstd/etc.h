@@ -11,4 +11,11 @@
 
 #define ISINRANGE(__MIN, __X, __MAX) ((__MIN) <= (__X) && (__X) < (__MAX))
 
+// Inline even big functions, so constant arguments get folded into the body
+#ifdef __GNUC__
+#define FORCE_INLINE inline __attribute__((always_inline))
+#else
+#define FORCE_INLINE inline
+#endif  // __GNUC__
+
 #endif  // SSTD_ETC_H_
@@ -0,0 +1,390 @@
+/*
+ * SMOLL FOLLOW LIB
+ *
+ * Remembers how far growing files were processed (`tail -f` style), detects
+ * truncation and rotation, and sleeps until something changes.
+ *
+ * NOTICE: This is single-header lib, so yep, we got here definition and
+ * implementation at the same time
+ * */
+#ifndef SSTD_FOLLOW_H_
+#define SSTD_FOLLOW_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Upper bound for a single sleep, also used when inotify isn't available
+#define FOLLOW_POLL_INTERVAL_MS 1000
+
+// How many bytes right before `offset` are remembered to notice the file was
+// truncated and written again past `offset` between two syncs
+#define FOLLOW_MARK_SIZE 64
+
+typedef enum {
+  FOLLOW_NONE = 0,
+  FOLLOW_APPENDED,
+  FOLLOW_TRUNCATED,
+  FOLLOW_ROTATED,
+} follow_event_t;
+
+/*
+ * Per-file state. `offset` always points right after the last processed
+ * line, `line` and `blank_run` are owned by the caller (line number and
+ * count of trailing blank lines respectively).
+ *
+ * `fd` stays open between syncs, so lines appended to a file after it was
+ * rotated away can still be read from it.
+ * */
+typedef struct {
+  const char *path;
+  unsigned long long dev;
+  unsigned long long ino;
+  unsigned long long offset;
+  unsigned long long line;
+  unsigned long long blank_run;
+  int fd;       // -1 until the file is seen
+  int next_fd;  // File which replaced `fd`, see `follow_entry_rotate`
+  unsigned long long mark_offset;
+  unsigned long long mark;  // Hash of bytes right before `mark_offset`
+} follow_entry_t;
+
+typedef struct {
+  int fd;
+} follow_watch_t;
+
+follow_entry_t follow_entry_init(const char *path);
+follow_event_t follow_entry_sync(follow_entry_t *entry, int fd);
+bool follow_entry_rotate(follow_entry_t *entry);
+void follow_entry_free(follow_entry_t *entry);
+
+follow_watch_t follow_watch_init(const follow_entry_t *entries, size_t count);
+void follow_watch_wait(follow_watch_t *watch);
+void follow_watch_free(follow_watch_t *watch);
+
+bool follow_checkpoint_load(const char *path, follow_entry_t *entries,
+                            size_t count);
+bool follow_checkpoint_save(const char *path, const follow_entry_t *entries,
+                            size_t count);
+
+#ifdef SSTD_FOLLOW_IMPL
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef OS_LINUX
+#include <sys/inotify.h>
+#endif  // OS_LINUX
+
+follow_entry_t follow_entry_init(const char *path) {
+  return (follow_entry_t){
+      .path = path,
+      .dev = 0,
+      .ino = 0,
+      .offset = 0,
+      .line = 0,
+      .blank_run = 0,
+      .fd = -1,
+      .next_fd = -1,
+      .mark_offset = 0,
+      .mark = 0,
+  };
+}
+
+static void follow_entry_reset(follow_entry_t *entry) {
+  entry->offset = 0;
+  entry->line = 0;
+  entry->blank_run = 0;
+  entry->mark_offset = 0;
+  entry->mark = 0;
+}
+
+/*
+ * FNV-1a of up to FOLLOW_MARK_SIZE bytes of `fd` right before `offset`.
+ *
+ * :returns: false if they can't be read, the file is shorter then
+ * */
+static bool follow_read_mark(int fd, unsigned long long offset,
+                             unsigned long long *mark) {
+  unsigned char buf[FOLLOW_MARK_SIZE];
+  size_t size = offset < FOLLOW_MARK_SIZE ? offset : FOLLOW_MARK_SIZE;
+  ssize_t got = pread(fd, buf, size, (off_t)(offset - size));
+
+  *mark = 14695981039346656037ULL;
+  for (ssize_t i = 0; i < got; ++i) {
+    *mark = (*mark ^ buf[i]) * 1099511628211ULL;
+  }
+
+  return got == (ssize_t)size;
+}
+
+static bool follow_isknown(const follow_entry_t *entry) {
+  return entry->dev != 0 || entry->ino != 0;
+}
+
+static bool follow_issame_file(const follow_entry_t *entry,
+                               const struct stat *st) {
+  return entry->dev == (unsigned long long)st->st_dev &&
+         entry->ino == (unsigned long long)st->st_ino;
+}
+
+/*
+ * Checks `entry->fd` against what we saw last time. Size alone misses a
+ * truncation followed by writes past `offset`, so bytes before the offset
+ * of the previous sync must be still the same too.
+ * */
+static follow_event_t follow_entry_check(follow_entry_t *entry) {
+  follow_event_t event = FOLLOW_NONE;
+  unsigned long long mark = 0;
+  struct stat st;
+
+  // NOTE: `fstat`, not `lseek`, readers rely on position of `fd` staying put
+  if (fstat(entry->fd, &st) != 0) {
+    return event;
+  }
+
+  unsigned long long size = st.st_size;
+
+  bool ismarked = entry->mark_offset > 0 || entry->mark != 0;
+  if (size < entry->offset ||
+      (ismarked && (!follow_read_mark(entry->fd, entry->mark_offset, &mark) ||
+                    mark != entry->mark))) {
+    follow_entry_reset(entry);
+    event = FOLLOW_TRUNCATED;
+  } else if (size > entry->offset) {
+    event = FOLLOW_APPENDED;
+  }
+
+  entry->mark_offset = entry->offset;
+  follow_read_mark(entry->fd, entry->mark_offset, &entry->mark);
+
+  return event;
+}
+
+/*
+ * Compares `fd` (freshly opened `entry->path`, -1 if there is no such file
+ * now) with what we saw last time, the entry takes care of `fd` from now on.
+ *
+ * :returns: What happened to the file since then. On truncation the entry
+ *           is rewound to the beginning of the file. On FOLLOW_ROTATED
+ *           `entry->fd` is still the old file: read the rest of it, then
+ *           switch to the new one with `follow_entry_rotate`.
+ * */
+follow_event_t follow_entry_sync(follow_entry_t *entry, int fd) {
+  struct stat st;
+
+  if (fd != -1 && fstat(fd, &st) != 0) {
+    close(fd);
+    fd = -1;
+  }
+
+  if (fd != -1 && entry->fd == -1) {
+    // First sight, checkpoint may be about another file though
+    bool isrotated = follow_isknown(entry) && !follow_issame_file(entry, &st);
+    entry->fd = fd;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+
+    if (isrotated) {
+      follow_entry_reset(entry);
+      follow_entry_check(entry);
+      return FOLLOW_ROTATED;
+    }
+  } else if (fd != -1 && follow_issame_file(entry, &st)) {
+    close(fd);
+  } else if (fd != -1) {
+    if (entry->next_fd != -1) {
+      close(entry->next_fd);
+    }
+    entry->next_fd = fd;
+    return FOLLOW_ROTATED;
+  }
+
+  return entry->fd != -1 ? follow_entry_check(entry) : FOLLOW_NONE;
+}
+
+/*
+ * Closes the old file after FOLLOW_ROTATED and starts from the beginning of
+ * the one which replaced it.
+ *
+ * :returns: false if there is nothing to switch to
+ * */
+bool follow_entry_rotate(follow_entry_t *entry) {
+  if (entry->next_fd == -1) {
+    return false;
+  }
+
+  struct stat st;
+  close(entry->fd);
+  entry->fd = entry->next_fd;
+  entry->next_fd = -1;
+
+  if (fstat(entry->fd, &st) == 0) {
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+  }
+
+  follow_entry_reset(entry);
+  follow_entry_check(entry);
+
+  return true;
+}
+
+void follow_entry_free(follow_entry_t *entry) {
+  if (entry->fd != -1) {
+    close(entry->fd);
+    entry->fd = -1;
+  }
+  if (entry->next_fd != -1) {
+    close(entry->next_fd);
+    entry->next_fd = -1;
+  }
+}
+
+/*
+ * NOTE: Parent directories are watched instead of files themselves, so we
+ * also hear about files which were renamed, recreated or not created yet.
+ * */
+follow_watch_t follow_watch_init(const follow_entry_t *entries, size_t count) {
+  follow_watch_t watch = {.fd = -1};
+
+#ifdef OS_LINUX
+  watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  for (size_t i = 0; watch.fd != -1 && i < count; ++i) {
+    const char *path = entries[i].path;
+    const char *slash = strrchr(path, '/');
+    size_t dir_len = slash == NULL ? 0 : (size_t)(slash - path);
+    char *dir = calloc(dir_len + 2, sizeof(char));
+
+    if (slash == NULL) {
+      dir[0] = '.';
+    } else if (dir_len == 0) {
+      dir[0] = '/';
+    } else {
+      memcpy(dir, path, dir_len);
+    }
+
+    inotify_add_watch(watch.fd, dir,
+                      IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                          IN_MOVED_TO | IN_ATTRIB);
+    free(dir);
+  }
+#else
+  (void)entries;
+  (void)count;
+#endif  // OS_LINUX
+
+  return watch;
+}
+
+void follow_watch_wait(follow_watch_t *watch) {
+  if (watch->fd != -1) {
+    struct pollfd pfd = {.fd = watch->fd, .events = POLLIN, .revents = 0};
+
+    if (poll(&pfd, 1, FOLLOW_POLL_INTERVAL_MS) > 0) {
+      // Drain pending events, the caller rechecks every file anyway
+      char events[4096];
+      while (read(watch->fd, events, sizeof(events)) > 0) {
+      }
+    }
+  } else {
+    struct timespec delay = {
+        .tv_sec = FOLLOW_POLL_INTERVAL_MS / 1000,
+        .tv_nsec = (FOLLOW_POLL_INTERVAL_MS % 1000) * 1000000L,
+    };
+    nanosleep(&delay, NULL);
+  }
+}
+
+void follow_watch_free(follow_watch_t *watch) {
+  if (watch->fd != -1) {
+    close(watch->fd);
+    watch->fd = -1;
+  }
+}
+
+/*
+ * Checkpoint is a text file with a line per followed file:
+ *
+ *     <dev> <ino> <offset> <line> <blank_run> <path>
+ *
+ * Entries of files which aren't mentioned in checkpoint are left untouched.
+ *
+ * :returns: false if checkpoint can't be opened
+ * */
+bool follow_checkpoint_load(const char *path, follow_entry_t *entries,
+                            size_t count) {
+  FILE *file = fopen(path, "r");
+
+  if (file == NULL) {
+    return false;
+  }
+
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t line_len = 0;
+
+  while ((line_len = getline(&line, &line_size, file)) != -1) {
+    follow_entry_t saved = follow_entry_init(NULL);
+    int path_off = 0;
+
+    if (line_len > 0 && line[line_len - 1] == '\n') {
+      line[line_len - 1] = '\0';
+    }
+
+    if (sscanf(line, "%llu %llu %llu %llu %llu %n", &saved.dev, &saved.ino,
+               &saved.offset, &saved.line, &saved.blank_run, &path_off) < 5 ||
+        path_off == 0) {
+      continue;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      if (strcmp(entries[i].path, line + path_off) == 0) {
+        saved.path = entries[i].path;
+        entries[i] = saved;
+      }
+    }
+  }
+
+  free(line);
+  fclose(file);
+
+  return true;
+}
+
+/*
+ * NOTE: Written to a temporary file first and renamed over the old one, so
+ * the checkpoint is never half-written if we die in the middle.
+ * */
+bool follow_checkpoint_save(const char *path, const follow_entry_t *entries,
+                            size_t count) {
+  bool ok = false;
+  size_t tmp_path_size = strlen(path) + sizeof(".tmp");
+  char *tmp_path = calloc(tmp_path_size, sizeof(char));
+  snprintf(tmp_path, tmp_path_size, "%s.tmp", path);
+
+  FILE *file = fopen(tmp_path, "w");
+
+  if (file != NULL) {
+    for (size_t i = 0; i < count; ++i) {
+      const follow_entry_t *entry = entries + i;
+      fprintf(file, "%llu %llu %llu %llu %llu %s\n", entry->dev, entry->ino,
+              entry->offset, entry->line, entry->blank_run, entry->path);
+    }
+
+    ok = fclose(file) == 0 && rename(tmp_path, path) == 0;
+  }
+
+  free(tmp_path);
+
+  return ok;
+}
+
+#endif  // SSTD_FOLLOW_IMPL
+
+#endif  // SSTD_FOLLOW_H_
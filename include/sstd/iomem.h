@@ -0,0 +1,406 @@
+/*
+ * SMOLL IOMEM LIB
+ *
+ * Big I/O buffers backed by huge pages, hints for mapped input, placement of
+ * worker threads on NUMA nodes, and counters of page faults and TLB misses
+ * to see whether all of that helps.
+ *
+ * NOTICE: This is single-header lib, so yep, we got here definition and
+ * implementation at the same time. Includer needs _GNU_SOURCE.
+ * */
+#ifndef SSTD_IOMEM_H_
+#define SSTD_IOMEM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Buffers of that size and bigger get huge pages, smaller come from `malloc`
+#define IOMEM_HUGE_PAGE_SIZE (1 << 21)
+
+// Upper bound of NUMA nodes we place threads on
+#define IOMEM_MAX_NODES 64
+
+typedef struct {
+  long minor_faults;
+  long major_faults;
+  long long tlb_misses;  // -1 if counter isn't available
+  bool istlb_user_only;  // Misses inside syscalls (`read` copies) not counted
+  int tlb_fd;
+} iomem_stats_t;
+
+// CPUs a thread was allowed to run on, see `iomem_affinity_save`
+typedef struct iomem_affinity iomem_affinity_t;
+
+void *iomem_alloc(size_t size);
+void *iomem_resize(void *buf, size_t size, size_t new_size, size_t used);
+bool iomem_free(void *buf, size_t size);
+
+void iomem_advise_input(const void *data, size_t size, bool issequential);
+
+size_t iomem_numa_node_count(void);
+bool iomem_numa_pin(size_t index);
+iomem_affinity_t *iomem_affinity_save(void);
+void iomem_affinity_restore(iomem_affinity_t *affinity);
+
+iomem_stats_t iomem_stats_start(void);
+void iomem_stats_stop(iomem_stats_t *stats);
+void iomem_stats_print(const iomem_stats_t *stats, FILE *out);
+
+#ifdef SSTD_IOMEM_IMPL
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#ifdef OS_LINUX
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#endif  // OS_LINUX
+
+// Size of reserved huge pages is asked for explicitly, the default one may
+// be 1G and buffers would be rounded up to that
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+#define IOMEM_MAP_HUGE (MAP_HUGETLB | (21 << MAP_HUGE_SHIFT))
+#elif defined(MAP_HUGETLB)
+#define IOMEM_MAP_HUGE MAP_HUGETLB
+#endif  // MAP_HUGETLB && MAP_HUGE_SHIFT
+
+static size_t iomem_round(size_t size) {
+  return size < IOMEM_HUGE_PAGE_SIZE
+             ? size
+             : (size + IOMEM_HUGE_PAGE_SIZE - 1) &
+                   ~(size_t)(IOMEM_HUGE_PAGE_SIZE - 1);
+}
+
+/*
+ * Buffer of `size` bytes, big ones are mapped on their own and backed by
+ * huge pages: reserved 2M ones (MAP_HUGETLB) if the system has any,
+ * transparent ones (MADV_HUGEPAGE) otherwise. Pages are placed on the NUMA node of the
+ * thread which touches them first.
+ *
+ * :returns: NULL if out of memory, free it with `iomem_free` of same `size`
+ * */
+void *iomem_alloc(size_t size) {
+  if (size < IOMEM_HUGE_PAGE_SIZE) {
+    return malloc(size > 0 ? size : 1);
+  }
+
+  size = iomem_round(size);
+  void *buf = MAP_FAILED;
+
+#if defined(OS_LINUX) && defined(IOMEM_MAP_HUGE)
+  buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | IOMEM_MAP_HUGE, -1, 0);
+#endif  // OS_LINUX && IOMEM_MAP_HUGE
+
+  if (buf == MAP_FAILED) {
+    // NOTE(wittenbb): Transparent huge page needs aligned 2M of address
+    // space, so map one more and trim the ends
+    size_t padded = size + IOMEM_HUGE_PAGE_SIZE;
+    char *raw = mmap(NULL, padded, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (raw == MAP_FAILED) {
+      return NULL;
+    }
+
+    uintptr_t addr = (uintptr_t)raw;
+    char *aligned = (char *)((addr + IOMEM_HUGE_PAGE_SIZE - 1) &
+                             ~(uintptr_t)(IOMEM_HUGE_PAGE_SIZE - 1));
+    size_t head = aligned - raw;
+
+    // Failed trim would leave pieces `iomem_free` never gives back
+    if ((head > 0 && munmap(raw, head) != 0) ||
+        munmap(aligned + size, padded - head - size) != 0) {
+      munmap(raw, padded);
+      return NULL;
+    }
+    buf = aligned;
+
+#if defined(OS_LINUX) && defined(MADV_HUGEPAGE)
+    madvise(buf, size, MADV_HUGEPAGE);
+#endif  // OS_LINUX && MADV_HUGEPAGE
+  }
+
+  return buf;
+}
+
+/*
+ * Like `realloc`, but only the first `used` bytes are kept.
+ * */
+void *iomem_resize(void *buf, size_t size, size_t new_size, size_t used) {
+  if (buf == NULL) {
+    return iomem_alloc(new_size);
+  } else if (size < IOMEM_HUGE_PAGE_SIZE &&
+             new_size < IOMEM_HUGE_PAGE_SIZE) {
+    return realloc(buf, new_size > 0 ? new_size : 1);
+  } else if (iomem_round(size) == iomem_round(new_size)) {
+    return buf;
+  }
+
+  void *new_buf = iomem_alloc(new_size);
+
+  if (new_buf != NULL) {
+    memcpy(new_buf, buf, used < new_size ? used : new_size);
+    iomem_free(buf, size);
+  }
+
+  return new_buf;
+}
+
+/*
+ * :returns: false if `buf` wasn't unmapped, `size` isn't what it was
+ *           allocated with then
+ * */
+bool iomem_free(void *buf, size_t size) {
+  if (buf == NULL) {
+    return true;
+  } else if (size < IOMEM_HUGE_PAGE_SIZE) {
+    free(buf);
+    return true;
+  }
+
+  return munmap(buf, iomem_round(size)) == 0;
+}
+
+/*
+ * Tells the kernel that mapped input is going to be read soon, and read
+ * from start to end if `issequential` (pages behind may be dropped early,
+ * so don't say that about mappings which are read again).
+ * */
+void iomem_advise_input(const void *data, size_t size, bool issequential) {
+  // `madvise` wants page aligned start
+  long page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t mask = page_size > 0 ? (uintptr_t)page_size - 1 : 0;
+  uintptr_t begin = (uintptr_t)data & ~mask;
+
+  size += (uintptr_t)data - begin;
+
+  if (issequential) {
+    madvise((void *)begin, size, MADV_SEQUENTIAL);
+  }
+  madvise((void *)begin, size, MADV_WILLNEED);
+}
+
+/*
+ * Parses sysfs list like "0-3,8,10-11" into `ids`.
+ *
+ * :returns: How many ids were there, at most `capacity` are written
+ * */
+static size_t iomem_read_list(const char *path, unsigned *ids,
+                              size_t capacity) {
+  FILE *file = fopen(path, "r");
+  size_t count = 0;
+  unsigned first = 0, last = 0;
+  int got = 0;
+
+  while (file != NULL &&
+         (got = fscanf(file, "%u-%u", &first, &last)) >= 1) {
+    if (got == 1) {
+      last = first;
+    }
+    for (unsigned id = first; id <= last; ++id, ++count) {
+      if (count < capacity) {
+        ids[count] = id;
+      }
+    }
+    if (fgetc(file) != ',') {
+      break;
+    }
+  }
+
+  if (file != NULL) {
+    fclose(file);
+  }
+
+  return count;
+}
+
+static size_t iomem_numa_nodes(unsigned *nodes) {
+  size_t count = iomem_read_list("/sys/devices/system/node/has_cpu", nodes,
+                                 IOMEM_MAX_NODES);
+  return count < IOMEM_MAX_NODES ? count : IOMEM_MAX_NODES;
+}
+
+/*
+ * :returns: Number of NUMA nodes with CPUs, 0 if the system doesn't say
+ * */
+size_t iomem_numa_node_count(void) {
+  unsigned nodes[IOMEM_MAX_NODES];
+  return iomem_numa_nodes(nodes);
+}
+
+/*
+ * Pins the calling thread to CPUs of `index`th NUMA node (modulo their
+ * count), so it and memory it touches first stay on that node. Workers
+ * should pin themselves before allocating their buffers.
+ *
+ * :returns: false if nothing was pinned, thread keeps running anywhere
+ * */
+bool iomem_numa_pin(size_t index) {
+  bool ispinned = false;
+
+#ifdef OS_LINUX
+  unsigned nodes[IOMEM_MAX_NODES];
+  size_t node_count = iomem_numa_nodes(nodes);
+
+  if (node_count > 0) {
+    char path[64];
+    unsigned cpus[CPU_SETSIZE];
+    cpu_set_t set;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist",
+             nodes[index % node_count]);
+    size_t cpu_count = iomem_read_list(path, cpus, CPU_SETSIZE);
+
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < cpu_count && i < CPU_SETSIZE; ++i) {
+      if (cpus[i] < CPU_SETSIZE) {
+        CPU_SET(cpus[i], &set);
+      }
+    }
+
+    // Linux applies it to the calling thread only
+    ispinned = CPU_COUNT(&set) > 0 &&
+               sched_setaffinity(0, sizeof(set), &set) == 0;
+  }
+#else
+  (void)index;
+#endif  // OS_LINUX
+
+  return ispinned;
+}
+
+#ifdef OS_LINUX
+struct iomem_affinity {
+  cpu_set_t set;
+};
+#endif  // OS_LINUX
+
+/*
+ * Remembers CPUs the calling thread may run on, so a thread which isn't
+ * a worker of its own can be pinned for a while and put back.
+ *
+ * :returns: NULL if it can't be told, don't pin such thread then
+ * */
+iomem_affinity_t *iomem_affinity_save(void) {
+  iomem_affinity_t *affinity = NULL;
+
+#ifdef OS_LINUX
+  affinity = malloc(sizeof(iomem_affinity_t));
+
+  if (affinity != NULL &&
+      sched_getaffinity(0, sizeof(affinity->set), &affinity->set) != 0) {
+    free(affinity);
+    affinity = NULL;
+  }
+#endif  // OS_LINUX
+
+  return affinity;
+}
+
+/*
+ * Lets the calling thread run where it could at `iomem_affinity_save` and
+ * frees `affinity`, NULL is ignored.
+ * */
+void iomem_affinity_restore(iomem_affinity_t *affinity) {
+#ifdef OS_LINUX
+  if (affinity != NULL) {
+    sched_setaffinity(0, sizeof(affinity->set), &affinity->set);
+  }
+#endif  // OS_LINUX
+
+  free(affinity);
+}
+
+#ifdef OS_LINUX
+static int iomem_open_tlb_counter(bool isuser_only) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.inherit = 1;  // Threads started later count too, once they're joined
+  attr.exclude_kernel = isuser_only;
+  attr.exclude_hv = 1;
+
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                      PERF_FLAG_FD_CLOEXEC);
+}
+#endif  // OS_LINUX
+
+/*
+ * Starts counting page faults and data TLB misses of the whole process. The
+ * latter needs `perf_event_open`, which may be forbidden (see
+ * /proc/sys/kernel/perf_event_paranoid), kernel side is dropped first.
+ * */
+iomem_stats_t iomem_stats_start(void) {
+  iomem_stats_t stats = {
+      .minor_faults = 0,
+      .major_faults = 0,
+      .tlb_misses = -1,
+      .istlb_user_only = false,
+      .tlb_fd = -1,
+  };
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    stats.minor_faults = usage.ru_minflt;
+    stats.major_faults = usage.ru_majflt;
+  }
+
+#ifdef OS_LINUX
+  stats.tlb_fd = iomem_open_tlb_counter(false);
+  if (stats.tlb_fd == -1) {
+    stats.tlb_fd = iomem_open_tlb_counter(true);
+    stats.istlb_user_only = true;
+  }
+#endif  // OS_LINUX
+
+  return stats;
+}
+
+/*
+ * Turns counters into what happened since `iomem_stats_start`.
+ * */
+void iomem_stats_stop(iomem_stats_t *stats) {
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    stats->minor_faults = usage.ru_minflt - stats->minor_faults;
+    stats->major_faults = usage.ru_majflt - stats->major_faults;
+  }
+
+  if (stats->tlb_fd != -1) {
+    long long misses = 0;
+    if (read(stats->tlb_fd, &misses, sizeof(misses)) == sizeof(misses)) {
+      stats->tlb_misses = misses;
+    }
+    close(stats->tlb_fd);
+    stats->tlb_fd = -1;
+  }
+}
+
+void iomem_stats_print(const iomem_stats_t *stats, FILE *out) {
+  fprintf(out, "memory: %ld minor and %ld major page faults, ",
+          stats->minor_faults, stats->major_faults);
+
+  if (stats->tlb_misses < 0) {
+    fprintf(out, "dTLB misses not available\n");
+  } else {
+    fprintf(out, "%lld dTLB misses%s\n", stats->tlb_misses,
+            stats->istlb_user_only ? " (user space only)" : "");
+  }
+}
+
+#endif  // SSTD_IOMEM_IMPL
+
+#endif  // SSTD_IOMEM_H_
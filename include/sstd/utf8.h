@@ -0,0 +1,227 @@
+/*
+ * SMOLL UTF-8 LIB
+ *
+ * Validates and decodes UTF-8 the strict way (no overlong forms, surrogates
+ * or code points past U+10FFFF). Runs of ASCII are skipped 16 bytes at a
+ * time with SSE2 where it's available, so pure ASCII text never gets to the
+ * decoder at all.
+ *
+ * NOTICE: This is single-header lib, so yep, we got here definition and
+ * implementation at the same time
+ * */
+#ifndef SSTD_UTF8_H_
+#define SSTD_UTF8_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "etc.h"
+
+// Longest valid sequence
+#define UTF8_MAX_SEQ 4
+
+#define UTF8_IS_CONT(__C) EXPAND(((unsigned char)(__C) & 0xC0) == 0x80)
+
+size_t utf8_ascii_prefix(const char *s, size_t size);
+size_t utf8_decode(const char *s, size_t size, uint32_t *codepoint);
+size_t utf8_valid_prefix(const char *s, size_t size);
+size_t utf8_incomplete_tail(const char *s, size_t size);
+size_t utf8_char_start(const char *s, size_t size, size_t pos);
+size_t utf8_char_end(const char *s, size_t size, size_t pos);
+
+#ifdef SSTD_UTF8_IMPL
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif  // __SSE2__
+
+/*
+ * :returns: Length of sequence led by `lead` or 0 if it can't lead one
+ * */
+static inline size_t utf8_seq_size(unsigned char lead) {
+  size_t size = 0;
+
+  if (lead < 0x80) {
+    size = 1;
+  } else if (ISINRANGE(0xC2, lead, 0xE0)) {
+    size = 2;
+  } else if (ISINRANGE(0xE0, lead, 0xF0)) {
+    size = 3;
+  } else if (ISINRANGE(0xF0, lead, 0xF5)) {
+    size = 4;
+  }
+
+  return size;
+}
+
+/*
+ * Overlong forms, surrogates and too big code points are all told apart by
+ * the second byte alone.
+ * */
+static inline bool utf8_second_ok(unsigned char lead, unsigned char second) {
+  unsigned char min = 0x80, max = 0xBF;
+
+  if (lead == 0xE0) {
+    min = 0xA0;
+  } else if (lead == 0xED) {
+    max = 0x9F;
+  } else if (lead == 0xF0) {
+    min = 0x90;
+  } else if (lead == 0xF4) {
+    max = 0x8F;
+  }
+
+  return min <= second && second <= max;
+}
+
+/*
+ * :returns: Count of leading ASCII bytes of `s`
+ * */
+size_t utf8_ascii_prefix(const char *s, size_t size) {
+  size_t i = 0;
+
+#ifdef __SSE2__
+  for (; i + 16 <= size; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(s + i));
+    int mask = _mm_movemask_epi8(block);
+
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#else
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, s + i, sizeof(word));
+
+    if (word & 0x8080808080808080ULL) {
+      break;
+    }
+  }
+#endif  // __SSE2__
+
+  while (i < size && (unsigned char)s[i] < 0x80) {
+    ++i;
+  }
+
+  return i;
+}
+
+/*
+ * :returns: Size of valid sequence at `s` or 0 if it's invalid or cut short
+ *           by `size`
+ * */
+size_t utf8_decode(const char *s, size_t size, uint32_t *codepoint) {
+  const unsigned char *u = (const unsigned char *)s;
+  size_t seq_size = size > 0 ? utf8_seq_size(u[0]) : 0;
+
+  if (seq_size == 0 || seq_size > size ||
+      (seq_size > 1 && !utf8_second_ok(u[0], u[1]))) {
+    return 0;
+  }
+
+  uint32_t value = seq_size == 1 ? u[0] : u[0] & (0x7F >> seq_size);
+
+  for (size_t i = 1; i < seq_size; ++i) {
+    if (!UTF8_IS_CONT(u[i])) {
+      return 0;
+    }
+    value = (value << 6) | (u[i] & 0x3F);
+  }
+
+  if (codepoint != NULL) {
+    *codepoint = value;
+  }
+
+  return seq_size;
+}
+
+/*
+ * :returns: Size of the longest valid prefix of `s`
+ * */
+size_t utf8_valid_prefix(const char *s, size_t size) {
+  size_t i = 0, seq_size = 0;
+
+  while (i < size) {
+    i += utf8_ascii_prefix(s + i, size - i);
+
+    if (i < size) {
+      if ((seq_size = utf8_decode(s + i, size - i, NULL)) == 0) {
+        break;
+      }
+      i += seq_size;
+    }
+  }
+
+  return i;
+}
+
+/*
+ * Tells how many trailing bytes of `s` are a valid sequence so far that's
+ * just missing its end, e.g. because a read stopped in the middle of it.
+ *
+ * :returns: Count of such bytes, at most UTF8_MAX_SEQ - 1
+ * */
+size_t utf8_incomplete_tail(const char *s, size_t size) {
+  const unsigned char *u = (const unsigned char *)s;
+
+  for (size_t tail = 1; tail < UTF8_MAX_SEQ && tail <= size; ++tail) {
+    unsigned char lead = u[size - tail];
+
+    if (!UTF8_IS_CONT(lead)) {
+      bool isok = utf8_seq_size(lead) > tail &&
+                  (tail == 1 || utf8_second_ok(lead, u[size - tail + 1]));
+      return isok ? tail : 0;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * :returns: Start of valid sequence `s[pos]` is a continuation byte of or
+ *           `size` (no such sequence)
+ * */
+static size_t utf8_find_lead(const char *s, size_t size, size_t pos) {
+  for (size_t back = 1; back < UTF8_MAX_SEQ && back <= pos; ++back) {
+    if (!UTF8_IS_CONT(s[pos - back])) {
+      size_t lead = pos - back;
+      return utf8_decode(s + lead, size - lead, NULL) > back ? lead : size;
+    }
+  }
+
+  return size;
+}
+
+/*
+ * :returns: `pos` moved back to the start of the character it's inside of,
+ *           stays as is on a character boundary or inside invalid bytes
+ * */
+size_t utf8_char_start(const char *s, size_t size, size_t pos) {
+  if (pos >= size || !UTF8_IS_CONT(s[pos])) {
+    return pos;
+  }
+
+  size_t lead = utf8_find_lead(s, size, pos);
+  return lead != size ? lead : pos;
+}
+
+/*
+ * :returns: `pos` moved forward to the end of the character it's inside of,
+ *           stays as is on a character boundary or inside invalid bytes
+ * */
+size_t utf8_char_end(const char *s, size_t size, size_t pos) {
+  if (pos >= size || !UTF8_IS_CONT(s[pos])) {
+    return pos;
+  }
+
+  size_t lead = utf8_find_lead(s, size, pos);
+  return lead != size ? lead + utf8_decode(s + lead, size - lead, NULL) : pos;
+}
+
+#endif  // SSTD_UTF8_IMPL
+
+#endif  // SSTD_UTF8_H_
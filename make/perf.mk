@@ -0,0 +1,51 @@
+# ============== [ PERF ] ==============
+#
+# `make pgo` builds instrumented binaries with BUILD_CONFIG=PERF, trains
+# them on every workload of the benchmark and builds them again with the
+# collected profile.
+#
+# `make perf-baseline` stores throughput of current binaries, `make
+# perf-check` fails if any workload got slower than that by more than
+# PERF_THRESHOLD percent. Baseline is only comparable on the same machine.
+BENCH_DIR       := $(SRCROOT)/bench
+BENCH_CORPUS    := $(BENCH_DIR)/corpus
+BENCH_WORKLOADS := $(BENCH_DIR)/workloads.txt
+BENCH_SIZE_MB   ?= 64
+BENCH_RUNS      ?= 5
+
+PERF_BASELINE  ?= $(BENCH_DIR)/baseline.json
+PERF_THRESHOLD ?= 10
+
+BENCH = python3 $(BENCH_DIR)/bench.py $(BENCH_CORPUS) $(BENCH_WORKLOADS) \
+	--cat $(CAT_BIN) --grep $(GREP_BIN) --runs $(BENCH_RUNS)
+
+$(BENCH_CORPUS)/.stamp: $(BENCH_DIR)/gen_corpus.py
+	$(RM) -r $(BENCH_CORPUS)
+	python3 $< $(BENCH_CORPUS) --size-mb $(BENCH_SIZE_MB)
+	touch $@
+
+bench-corpus: $(BENCH_CORPUS)/.stamp
+
+bench: $(CAT_BIN) $(GREP_BIN) bench-corpus
+	$(BENCH)
+
+perf-baseline: $(CAT_BIN) $(GREP_BIN) bench-corpus
+	$(BENCH) --save $(PERF_BASELINE)
+
+perf-check: $(CAT_BIN) $(GREP_BIN) bench-corpus
+	$(BENCH) --check $(PERF_BASELINE) --threshold $(PERF_THRESHOLD)
+
+pgo: bench-corpus
+	$(RM) -r $(PGO_DIR)
+	$(MAKE) clean
+	$(MAKE) s21_cat s21_grep BUILD_CONFIG=PERF USE_PGO=GENERATE
+	$(BENCH) --train
+	$(MAKE) clean
+	$(MAKE) all BUILD_CONFIG=PERF USE_PGO=USE
+
+.PHONY: \
+	bench-corpus \
+	bench \
+	perf-baseline \
+	perf-check \
+	pgo
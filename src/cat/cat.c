@@ -1,48 +1,42 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-#include "sstd/bits.h"
-
-#define ASCII_DEL EXPAND(127)
-#define CARET_OFFSET EXPAND(64)
-
-#define OPT_NONE EXPAND(0)
-
-// -b --number-nonblank (overrides -n --number)
-#define OPT_NUMBER_NONBLANK MKFLAG(0)
-
-// -n --number
-#define OPT_NUMBER MKFLAG(1)
-
-// -s --squeeze-blank
-#define OPT_SQUEEZE_BLANK MKFLAG(2)
-
-// -v --show-nonprinting: use ^ and M- notation, except for LFD and TAB
-#define OPT_SHOW_NONPRINTING MKFLAG(3)
+#ifndef SSTD_FOLLOW_IMPL
+#define SSTD_FOLLOW_IMPL
+#endif  // SSTD_FOLLOW_IMPL
 
-// -T --show-tabs  (display tabs as ^I)
-#define OPT_SHOW_TABS MKFLAG(4)
+#ifndef SSTD_IOMEM_IMPL
+#define SSTD_IOMEM_IMPL
+#endif  // SSTD_IOMEM_IMPL
 
-// -E --show-ends (display end of each line with $)
-#define OPT_SHOW_ENDS MKFLAG(5)
-
-// -A --show-all  (eq. to -vET)
-#define OPT_SHOW_ALL \
-  EXPAND(OPT_SHOW_NONPRINTING | OPT_SHOW_ENDS | OPT_SHOW_TABS)
+#include "format.h"
+#include "opts.h"
+#include "pipeline.h"
+#include "sstd/bits.h"
+#include "sstd/follow.h"
+#include "sstd/iomem.h"
+#include "sstd/utf8.h"
 
-// NOTE:
-//  * -e (-vE)
-//  * -t (-vT)
-//  * -u (ignored)
+// Size of a single read of input file
+#define CAT_READ_SIZE (1 << 16)
 
-#define OPT_HELP MKFLAG(10)
+// Same for big regular files, so buffer takes exactly one huge page
+#define CAT_HUGE_READ_SIZE EXPAND(IOMEM_HUGE_PAGE_SIZE - UTF8_MAX_SEQ)
 
 #define MAKE_LONG_OPT(NAME, OPT) \
   { (NAME), no_argument, NULL, (OPT) }
 
+#define MAKE_PARAM_OPT(NAME, OPT) \
+  { (NAME), required_argument, NULL, (OPT) }
+
 static const struct option LONG_OPTIONS[] = {
     MAKE_LONG_OPT("help", OPT_HELP),
     MAKE_LONG_OPT("number-nonblank", OPT_NUMBER_NONBLANK),
@@ -52,103 +46,163 @@ static const struct option LONG_OPTIONS[] = {
     MAKE_LONG_OPT("show-tabs", OPT_SHOW_TABS),
     MAKE_LONG_OPT("show-ends", OPT_SHOW_ENDS),
     MAKE_LONG_OPT("show-all", OPT_SHOW_ALL),
+    MAKE_LONG_OPT("utf8", OPT_UTF8),
+    MAKE_LONG_OPT("follow", OPT_FOLLOW),
+    MAKE_LONG_OPT("numa", OPT_NUMA),
+    MAKE_LONG_OPT("verbose", OPT_VERBOSE),
+    MAKE_PARAM_OPT("checkpoint", PARAM_CHECKPOINT),
+    MAKE_PARAM_OPT("jobs", PARAM_JOBS),
+    {0},
 };
 
 static const char *SHORT_OPTS = "bnsvTEAetu";
 
-static bool is_caret_printable(char c) {
-  return (c < ' ' || c == ASCII_DEL) && c != '\t' && c != '\n';
-}
+static long long fprint_fd_opts(FILE *in, FILE *out, fprint_state_t *state,
+                                int opts) {
+  if (in == NULL || out == NULL) {
+    return -1;
+  }
+
+  unsigned long long charcount = state->charcount;
+  struct stat st;
+  size_t read_size = fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode) &&
+                             st.st_size >= IOMEM_HUGE_PAGE_SIZE
+                         ? CAT_HUGE_READ_SIZE
+                         : CAT_READ_SIZE;
+  size_t capacity = read_size + UTF8_MAX_SEQ;
+  char *buf = iomem_alloc(capacity);
+  size_t kept = 0;
+  ssize_t got = 0;
+
+  while (buf != NULL && (got = read(fileno(in), buf + kept, read_size)) > 0) {
+    size_t size = kept + got;
+
+    // Character cut by the read goes with the next block
+    kept = HASFLAG(opts, OPT_UTF8) ? utf8_incomplete_tail(buf, size) : 0;
+    fprint_buf_opts(out, state, buf, size - kept, opts);
+    memmove(buf, buf + size - kept, kept);
+  }
 
-static bool is_m_printable(unsigned char c) { return c > CHAR_MAX; }
+  fprint_buf_opts(out, state, buf, kept, opts);
+  iomem_free(buf, capacity);
+
+  return state->charcount - charcount;
+}
 
 /*
- * :returns: Returns nonprintable char in caret notation
+ * Prints only complete lines appended after `entry->offset` of `entry->fd`,
+ * trailing line without '\n' is left for the next time.
+ *
+ * :returns: false if the file can't be read
  * */
-static char get_caret_notation(char c) {
-  char ret = 0;
+static bool fprint_fd_tail_opts(FILE *out, follow_entry_t *entry, int opts) {
+  // Entry keeps its fd open, the stream gets a copy of it
+  int fd = dup(entry->fd);
+  FILE *in = fd != -1 ? fdopen(fd, "r") : NULL;
+
+  if (in == NULL) {
+    if (fd != -1) {
+      close(fd);
+    }
+    return false;
+  }
 
-  if (c < ' ' && c != '\t' && c != '\n') {
-    ret = c + CARET_OFFSET;
-  } else if (c == ASCII_DEL) {
-    ret = c - CARET_OFFSET;
+  // NOTE: Entry always stops right after '\n', so that's our previous char
+  fprint_state_t state = {
+      .charcount = entry->offset,
+      .linenumber = entry->line + 1,
+      .blankcount = entry->blank_run,
+      .prevchar = '\n',
+  };
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t line_len = 0;
+
+  if (fseeko(in, (off_t)entry->offset, SEEK_SET) == 0) {
+    while ((line_len = getline(&line, &line_size, in)) != -1 &&
+           line[line_len - 1] == '\n') {
+      fprint_buf_opts(out, &state, line, line_len, opts);
+      entry->offset += line_len;
+    }
   }
 
-  return ret;
-}
+  entry->line = state.linenumber - 1;
+  entry->blank_run = state.blankcount;
 
-static char get_m_caret_notation(unsigned char c) {
-  char ret = c - CHAR_MAX - 1;
-  if (ret < ' ') {
-    ret += CARET_OFFSET;
-  }
-  return ret;
-}
+  free(line);
+  fclose(in);
 
-static void fprint_prefix(FILE *out, unsigned long long *linenumber,
-                          bool isnewline, bool isblank, int opts) {
-  // Kinda hacky but anyway
-  if (HASFLAG(opts, OPT_NUMBER_NONBLANK) && isnewline && !isblank) {
-    fprintf(out, "%6llu\t", *linenumber);
-    ++(*linenumber);
-  } else if (HASFLAG(opts, OPT_NUMBER) && isnewline &&
-             !(HASFLAG(opts, OPT_NUMBER_NONBLANK))) {
-    fprintf(out, "%6llu\t", *linenumber);
-    ++(*linenumber);
-  }
+  return true;
 }
 
-static void fputchar_opts(FILE *out, char curchar, int opts) {
-  if (HASFLAG(opts, OPT_SHOW_ENDS) && curchar == '\n') {
-    fputs("$\n", out);
-  } else if (HASFLAG(opts, OPT_SHOW_TABS) && curchar == '\t') {
-    fputs("^I", out);
-  } else if (HASFLAG(opts, OPT_SHOW_NONPRINTING) &&
-             is_m_printable((unsigned char)curchar)) {
-    if ((unsigned char)curchar >= CHAR_MAX + 1 &&
-        ((unsigned char)curchar - CHAR_MAX - 1) < ' ') {
-      fprintf(out, "M-^%c", get_m_caret_notation(curchar));
-    } else {
-      fprintf(out, "M-%c", get_m_caret_notation(curchar));
-    }
-  } else if (HASFLAG(opts, OPT_SHOW_NONPRINTING) &&
-             is_caret_printable(curchar)) {
-    fprintf(out, "^%c", get_caret_notation(curchar));
-  } else {
-    fputc(curchar, out);
+static int follow_files(const char **f_paths, size_t count, int opts,
+                        const params_t *params) {
+  int ret = EXIT_SUCCESS;
+  follow_entry_t *entries = calloc(count, sizeof(follow_entry_t));
+
+  for (size_t i = 0; i < count; ++i) {
+    entries[i] = follow_entry_init(f_paths[i]);
   }
-}
 
-static long long fprint_fd_opts(FILE *in, FILE *out, int opts) {
-  if (in == NULL || out == NULL) {
-    return -1;
+  if (params->checkpoint_path != NULL) {
+    follow_checkpoint_load(params->checkpoint_path, entries, count);
   }
 
-  unsigned long long charcount = 0, linenumber = 1, blankcount = 0;
-  char curchar = 0, prevchar = 0;
+  follow_watch_t watch = follow_watch_init(entries, count);
 
-  while ((curchar = fgetc(in)) != EOF) {
-    bool isblank = curchar == '\n' && (prevchar == '\n' || charcount == 0);
-    bool isnewline = prevchar == '\n' || charcount == 0;
+  for (bool isfirst = true; ret == EXIT_SUCCESS; isfirst = false) {
+    bool haschanges = false;
 
-    if (isblank) {
-      ++blankcount;
-    } else {
-      blankcount = 0;
+    for (size_t i = 0; i < count; ++i) {
+      follow_entry_t *entry = entries + i;
+      int fd = open(entry->path, O_RDONLY);
+
+      if (fd == -1 && isfirst) {
+        fprintf(stderr, "error: Failed to find file '%s'\n", entry->path);
+      }
+
+      follow_event_t event = follow_entry_sync(entry, fd);
+      bool isread = true;
+
+      // Lines appended to the old file before rotation come first
+      if (event == FOLLOW_ROTATED) {
+        isread = fprint_fd_tail_opts(stdout, entry, opts);
+        follow_entry_rotate(entry);
+      }
+
+      if (event != FOLLOW_NONE) {
+        isread = fprint_fd_tail_opts(stdout, entry, opts) && isread;
+        haschanges = true;
+      }
+
+      if (!isread) {
+        fprintf(stderr, "error: Failed to read file '%s'\n", entry->path);
+      }
     }
 
-    if (HASFLAG(opts, OPT_SQUEEZE_BLANK) && isblank && blankcount > 1) {
-      // Skip it
-    } else {
-      fprint_prefix(out, &linenumber, isnewline, isblank, opts);
-      fputchar_opts(out, curchar, opts);
-      prevchar = curchar;
+    if (haschanges) {
+      fflush(stdout);
+
+      if (params->checkpoint_path != NULL &&
+          !follow_checkpoint_save(params->checkpoint_path, entries, count)) {
+        fprintf(stderr, "error: Failed to save checkpoint '%s'\n",
+                params->checkpoint_path);
+        ret = EXIT_FAILURE;
+      }
     }
 
-    ++charcount;
+    if (ret == EXIT_SUCCESS) {
+      follow_watch_wait(&watch);
+    }
   }
 
-  return charcount;
+  follow_watch_free(&watch);
+  for (size_t i = 0; i < count; ++i) {
+    follow_entry_free(entries + i);
+  }
+  free(entries);
+
+  return ret;
 }
 
 static void print_help(void) {
@@ -165,12 +219,25 @@ static void print_help(void) {
       "    -T --show-tabs        (display tabs as ^I)\n"
       "    -E --show-ends        (display end of each line with $)\n"
       "    -A --show-all         (same as -vET)\n"
+      "    --utf8                (with -v print valid UTF-8 characters as "
+      "is, use M- notation only for invalid bytes and C1 controls)\n"
       "    -e                    (same as -vE)\n"
       "    -t                    (same as -vT)\n"
-      "    -h --help             (display this help message)\n");
+      "    -h --help             (display this help message)\n"
+      "    --follow              (keep printing lines appended to FILES, "
+      "survives truncation and rotation)\n"
+      "    --checkpoint FILE     (resume --follow from offsets saved in FILE "
+      "and keep it updated)\n"
+      "    --jobs N              (read and format upcoming files and chunks "
+      "of big files on N threads, output order is kept)\n"
+      "    --numa                (spread --jobs threads over NUMA nodes, "
+      "pinning each one to CPUs of its node)\n"
+      "    --verbose             (report page faults and TLB misses to "
+      "stderr)\n");
 }
 
-static int make_opts(int *out_mask, int argc, char *const *argv) {
+static int make_opts(int *out_mask, params_t *params, int argc,
+                     char *const *argv) {
   int ret = EXIT_SUCCESS, opt_value = 0, opt_index = 0;
 
   while ((opt_value = getopt_long(argc, argv, SHORT_OPTS, LONG_OPTIONS,
@@ -198,12 +265,29 @@ static int make_opts(int *out_mask, int argc, char *const *argv) {
     } else if (opt_value == OPT_SHOW_ALL || opt_value == 'A') {
       // -A --show-all  (eq. to -vET)
       ADDFLAG(*out_mask, OPT_SHOW_ALL);
+    } else if (opt_value == OPT_UTF8) {
+      ADDFLAG(*out_mask, OPT_UTF8);
     } else if (opt_value == 'e') {
       ADDFLAG(*out_mask, OPT_SHOW_NONPRINTING | OPT_SHOW_ENDS);
     } else if (opt_value == 't') {
       ADDFLAG(*out_mask, OPT_SHOW_NONPRINTING | OPT_SHOW_TABS);
     } else if (opt_value == 'u') {
       // Ignore
+    } else if (opt_value == OPT_FOLLOW) {
+      ADDFLAG(*out_mask, OPT_FOLLOW);
+    } else if (opt_value == OPT_NUMA) {
+      ADDFLAG(*out_mask, OPT_NUMA);
+    } else if (opt_value == OPT_VERBOSE) {
+      ADDFLAG(*out_mask, OPT_VERBOSE);
+    } else if (opt_value == PARAM_CHECKPOINT) {
+      params->checkpoint_path = optarg;
+    } else if (opt_value == PARAM_JOBS) {
+      char *optarg_end = NULL;
+      params->job_count = strtoul(optarg, &optarg_end, 10);
+      if (*optarg == '\0' || *optarg_end != '\0') {
+        fprintf(stderr, "error: Invalid number of jobs '%s'\n", optarg);
+        ret = EXIT_FAILURE;
+      }
     } else {
       ret = EXIT_FAILURE;
     }
@@ -212,14 +296,21 @@ static int make_opts(int *out_mask, int argc, char *const *argv) {
   return ret;
 }
 
-static int process_files(const char **f_paths, size_t count, int opts) {
+static int process_files(const char **f_paths, size_t count, int opts,
+                         const params_t *params) {
   int ret = EXIT_SUCCESS;
+  fprint_state_t state = fprint_state_init();
+
+  if (params->job_count > 1) {
+    return pipeline_process_files(stdout, f_paths, count, opts,
+                                  params->job_count, &state);
+  }
 
   for (size_t i = 0; i < count; ++i) {
     const char *f_path = f_paths[i];
     FILE *f_in = fopen(f_path, "r");
 
-    if (fprint_fd_opts(f_in, stdout, opts) == -1) {
+    if (fprint_fd_opts(f_in, stdout, &state, opts) == -1) {
       fprintf(stderr, "error: Failed to find file '%s'\n", f_path);
       ret = EXIT_FAILURE;
     }
@@ -234,8 +325,9 @@ static int process_files(const char **f_paths, size_t count, int opts) {
 
 int main(int argc, char **argv) {
   int ret = EXIT_SUCCESS, opts = OPT_NONE;
+  params_t params = {.checkpoint_path = NULL, .job_count = 1};
 
-  if (make_opts(&opts, argc, argv) != EXIT_SUCCESS) {
+  if (make_opts(&opts, &params, argc, argv) != EXIT_SUCCESS) {
     ret = EXIT_FAILURE;
   } else {
     if (HASFLAG(opts, OPT_HELP)) {
@@ -243,7 +335,18 @@ int main(int argc, char **argv) {
     } else {
       size_t args_left = argc - optind;
       const char **f_paths = (const char **)(argv + optind);
-      process_files(f_paths, args_left, opts);
+
+      if (HASFLAG(opts, OPT_FOLLOW)) {
+        ret = follow_files(f_paths, args_left, opts, &params);
+      } else if (HASFLAG(opts, OPT_VERBOSE)) {
+        iomem_stats_t stats = iomem_stats_start();
+        process_files(f_paths, args_left, opts, &params);
+        fflush(stdout);
+        iomem_stats_stop(&stats);
+        iomem_stats_print(&stats, stderr);
+      } else {
+        process_files(f_paths, args_left, opts, &params);
+      }
     }
   }
 
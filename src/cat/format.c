@@ -0,0 +1,271 @@
+#define _GNU_SOURCE
+#include "format.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef SSTD_UTF8_IMPL
+#define SSTD_UTF8_IMPL
+#endif  // SSTD_UTF8_IMPL
+
+#include "opts.h"
+#include "sstd/bits.h"
+#include "sstd/etc.h"
+#include "sstd/utf8.h"
+
+#define ASCII_DEL EXPAND(127)
+#define CARET_OFFSET EXPAND(64)
+
+// U+0080..U+009F are control characters, --utf8 still escapes their bytes
+#define UTF8_C1_END EXPAND(0xA0)
+
+// After that many leading '\n's every next one is a blank line which gets
+// squeezed or numbered exactly like the previous one
+#define FORMAT_LEAD_STEPS 3
+
+typedef enum {
+  FORMAT_SKIP,
+  FORMAT_PRINT,
+  FORMAT_PRINT_NUMBERED,
+} format_action_t;
+
+static bool is_caret_printable(char c) {
+  return (c < ' ' || c == ASCII_DEL) && c != '\t' && c != '\n';
+}
+
+static bool is_m_printable(unsigned char c) { return c > CHAR_MAX; }
+
+/*
+ * :returns: Returns nonprintable char in caret notation
+ * */
+static char get_caret_notation(char c) {
+  char ret = 0;
+
+  if (c < ' ' && c != '\t' && c != '\n') {
+    ret = c + CARET_OFFSET;
+  } else if (c == ASCII_DEL) {
+    ret = c - CARET_OFFSET;
+  }
+
+  return ret;
+}
+
+static char get_m_caret_notation(unsigned char c) {
+  char ret = c - CHAR_MAX - 1;
+  if (ret < ' ') {
+    ret += CARET_OFFSET;
+  }
+  return ret;
+}
+
+/*
+ * NOTE(wittenbb): `putc_unlocked` everywhere, `out` is never shared between
+ * threads and locking it for every char made pipeline 2.5x slower
+ * */
+static void fputchar_opts(FILE *out, char curchar, int opts) {
+  if (HASFLAG(opts, OPT_SHOW_ENDS) && curchar == '\n') {
+    putc_unlocked('$', out);
+    putc_unlocked('\n', out);
+  } else if (HASFLAG(opts, OPT_SHOW_TABS) && curchar == '\t') {
+    putc_unlocked('^', out);
+    putc_unlocked('I', out);
+  } else if (HASFLAG(opts, OPT_SHOW_NONPRINTING) &&
+             is_m_printable((unsigned char)curchar)) {
+    putc_unlocked('M', out);
+    putc_unlocked('-', out);
+    if ((unsigned char)curchar >= CHAR_MAX + 1 &&
+        ((unsigned char)curchar - CHAR_MAX - 1) < ' ') {
+      putc_unlocked('^', out);
+      putc_unlocked(get_m_caret_notation(curchar), out);
+    } else if ((unsigned char)curchar - CHAR_MAX - 1 == ASCII_DEL) {
+      putc_unlocked('^', out);
+      putc_unlocked('?', out);
+    } else {
+      putc_unlocked(get_m_caret_notation(curchar), out);
+    }
+  } else if (HASFLAG(opts, OPT_SHOW_NONPRINTING) &&
+             is_caret_printable(curchar)) {
+    putc_unlocked('^', out);
+    putc_unlocked(get_caret_notation(curchar), out);
+  } else {
+    putc_unlocked(curchar, out);
+  }
+}
+
+/*
+ * Moves `state` past `curchar`, numbered lines take `state->linenumber`
+ * before it's incremented.
+ *
+ * :returns: What should be printed for `curchar`
+ * */
+static FORCE_INLINE format_action_t format_advance(fprint_state_t *state,
+                                                   char curchar, int opts) {
+  format_action_t action = FORMAT_SKIP;
+  bool isnewline = state->prevchar == '\n' || state->charcount == 0;
+  bool isblank = curchar == '\n' && isnewline;
+
+  if (isblank) {
+    ++state->blankcount;
+  } else {
+    state->blankcount = 0;
+  }
+
+  if (HASFLAG(opts, OPT_SQUEEZE_BLANK) && isblank && state->blankcount > 1) {
+    // Skip it
+  } else {
+    action = FORMAT_PRINT;
+
+    // Kinda hacky but anyway
+    if (HASFLAG(opts, OPT_NUMBER_NONBLANK) && isnewline && !isblank) {
+      action = FORMAT_PRINT_NUMBERED;
+    } else if (HASFLAG(opts, OPT_NUMBER) && isnewline &&
+               !(HASFLAG(opts, OPT_NUMBER_NONBLANK))) {
+      action = FORMAT_PRINT_NUMBERED;
+    }
+
+    if (action == FORMAT_PRINT_NUMBERED) {
+      ++state->linenumber;
+    }
+
+    state->prevchar = curchar;
+  }
+
+  ++state->charcount;
+
+  return action;
+}
+
+fprint_state_t fprint_state_init(void) {
+  return (fprint_state_t){
+      .charcount = 0,
+      .linenumber = 1,
+      .blankcount = 0,
+      .prevchar = 0,
+  };
+}
+
+void fprint_char_opts(FILE *out, fprint_state_t *state, char curchar,
+                      int opts) {
+  format_action_t action = format_advance(state, curchar, opts);
+
+  if (action == FORMAT_PRINT_NUMBERED) {
+    fprintf(out, "%6llu\t", state->linenumber - 1);
+  }
+
+  if (action != FORMAT_SKIP) {
+    fputchar_opts(out, curchar, opts);
+  }
+}
+
+/*
+ * Prints valid multibyte character `seq` as is. None of its bytes is '\n',
+ * so it moves `state` like any other run of printable chars.
+ * */
+static void fprint_seq_opts(FILE *out, fprint_state_t *state, const char *seq,
+                            size_t size, int opts) {
+  format_action_t action = format_advance(state, seq[0], opts);
+
+  for (size_t i = 1; i < size; ++i) {
+    format_advance(state, seq[i], opts);
+  }
+
+  if (action == FORMAT_PRINT_NUMBERED) {
+    fprintf(out, "%6llu\t", state->linenumber - 1);
+  }
+
+  fwrite_unlocked(seq, sizeof(char), size, out);
+}
+
+/*
+ * With --utf8 and -v only the non-ASCII parts of `buf` are decoded, runs of
+ * ASCII are found 16 bytes at a time and go char by char as usual.
+ * */
+void fprint_buf_opts(FILE *out, fprint_state_t *state, const char *buf,
+                     size_t size, int opts) {
+  bool isutf8 =
+      HASFLAG(opts, OPT_UTF8) && HASFLAG(opts, OPT_SHOW_NONPRINTING);
+  size_t i = 0;
+
+  while (i < size) {
+    size_t ascii_end =
+        isutf8 ? i + utf8_ascii_prefix(buf + i, size - i) : size;
+
+    for (; i < ascii_end; ++i) {
+      fprint_char_opts(out, state, buf[i], opts);
+    }
+
+    if (i < size) {
+      uint32_t codepoint = 0;
+      size_t seq_size = utf8_decode(buf + i, size - i, &codepoint);
+
+      if (seq_size > 1 && codepoint >= UTF8_C1_END) {
+        fprint_seq_opts(out, state, buf + i, seq_size, opts);
+        i += seq_size;
+      } else {
+        fprint_char_opts(out, state, buf[i], opts);
+        ++i;
+      }
+    }
+  }
+}
+
+format_summary_t format_summarize(const char *buf, size_t size, int opts) {
+  size_t lead_newlines = 0;
+
+  while (lead_newlines < size && buf[lead_newlines] == '\n') {
+    ++lead_newlines;
+  }
+
+  format_summary_t summary = {
+      .size = size,
+      .lead_newlines = lead_newlines,
+      .first_char = lead_newlines < size ? buf[lead_newlines] : '\n',
+  };
+
+  summary.tail = (fprint_state_t){
+      .charcount = 1,
+      .linenumber = 0,
+      .blankcount = 0,
+      .prevchar = summary.first_char,
+  };
+
+  for (size_t i = lead_newlines + 1; i < size; ++i) {
+    format_advance(&summary.tail, buf[i], opts);
+  }
+
+  return summary;
+}
+
+/*
+ * Moves `state` past the whole piece described by `summary`, same as
+ * formatting the piece itself would, but in constant time.
+ * */
+void format_state_apply(fprint_state_t *state,
+                        const format_summary_t *summary, int opts) {
+  size_t stepped = summary->lead_newlines < FORMAT_LEAD_STEPS
+                       ? summary->lead_newlines
+                       : FORMAT_LEAD_STEPS;
+
+  for (size_t i = 0; i < stepped; ++i) {
+    format_advance(state, '\n', opts);
+  }
+
+  size_t rest = summary->lead_newlines - stepped;
+  state->charcount += rest;
+  state->blankcount += rest;
+
+  if (!HASFLAG(opts, OPT_SQUEEZE_BLANK) && HASFLAG(opts, OPT_NUMBER) &&
+      !HASFLAG(opts, OPT_NUMBER_NONBLANK)) {
+    state->linenumber += rest;
+  }
+
+  if (summary->lead_newlines < summary->size) {
+    format_advance(state, summary->first_char, opts);
+
+    state->charcount += summary->tail.charcount - 1;
+    state->linenumber += summary->tail.linenumber;
+    state->blankcount = summary->tail.blankcount;
+    state->prevchar = summary->tail.prevchar;
+  }
+}
@@ -0,0 +1,40 @@
+#ifndef CAT_FORMAT_H_
+#define CAT_FORMAT_H_
+
+#include <stdio.h>
+
+/*
+ * Everything `-n`, `-b` and `-s` need to know about previous characters
+ * */
+typedef struct {
+  unsigned long long charcount;
+  unsigned long long linenumber;
+  unsigned long long blankcount;
+  char prevchar;
+} fprint_state_t;
+
+/*
+ * What a piece of input does to `fprint_state_t`, regardless of the state it
+ * starts with. Leading '\n's are kept aside as they are the only part which
+ * depends on it, `tail` is the state after the rest of the piece had been
+ * formatted starting in the middle of a line with line number 0.
+ * */
+typedef struct {
+  size_t size;
+  size_t lead_newlines;
+  char first_char;
+  fprint_state_t tail;
+} format_summary_t;
+
+fprint_state_t fprint_state_init(void);
+
+void fprint_char_opts(FILE *out, fprint_state_t *state, char curchar,
+                      int opts);
+void fprint_buf_opts(FILE *out, fprint_state_t *state, const char *buf,
+                     size_t size, int opts);
+
+format_summary_t format_summarize(const char *buf, size_t size, int opts);
+void format_state_apply(fprint_state_t *state,
+                        const format_summary_t *summary, int opts);
+
+#endif  // CAT_FORMAT_H_
@@ -0,0 +1,70 @@
+#ifndef CAT_OPTS_H_
+#define CAT_OPTS_H_
+
+#include <stddef.h>
+
+#include "sstd/bits.h"
+
+#define OPT_NONE EXPAND(0)
+
+// -b --number-nonblank (overrides -n --number)
+#define OPT_NUMBER_NONBLANK MKFLAG(0)
+
+// -n --number
+#define OPT_NUMBER MKFLAG(1)
+
+// -s --squeeze-blank
+#define OPT_SQUEEZE_BLANK MKFLAG(2)
+
+// -v --show-nonprinting: use ^ and M- notation, except for LFD and TAB
+#define OPT_SHOW_NONPRINTING MKFLAG(3)
+
+// -T --show-tabs  (display tabs as ^I)
+#define OPT_SHOW_TABS MKFLAG(4)
+
+// -E --show-ends (display end of each line with $)
+#define OPT_SHOW_ENDS MKFLAG(5)
+
+// --utf8 (with -v valid UTF-8 characters are printed as is, M- notation is
+// left for invalid bytes and C1 control characters)
+#define OPT_UTF8 MKFLAG(6)
+
+// -A --show-all  (eq. to -vET)
+#define OPT_SHOW_ALL \
+  EXPAND(OPT_SHOW_NONPRINTING | OPT_SHOW_ENDS | OPT_SHOW_TABS)
+
+// NOTE:
+//  * -e (-vE)
+//  * -t (-vT)
+//  * -u (ignored)
+
+#define OPT_HELP MKFLAG(10)
+
+// --follow (keep printing lines appended to files)
+#define OPT_FOLLOW MKFLAG(11)
+
+// --numa (pin --jobs threads to NUMA nodes, round robin)
+#define OPT_NUMA MKFLAG(12)
+
+// --verbose (report page faults and TLB misses to stderr)
+#define OPT_VERBOSE MKFLAG(13)
+
+// Long options which only carry an argument. Never a power of two, so they
+// don't clash with `OPT_*` values returned by `getopt_long`
+#define PARAM_BASE EXPAND(MKFLAG(30) + 1)
+
+// --checkpoint FILE (where --follow keeps its offsets)
+#define PARAM_CHECKPOINT EXPAND(PARAM_BASE + 0)
+
+// --jobs N (read and format upcoming files on N threads)
+#define PARAM_JOBS EXPAND(PARAM_BASE + 1)
+
+/*
+ * Values of options which are more than just a flag in `opts`
+ * */
+typedef struct {
+  const char *checkpoint_path;
+  size_t job_count;
+} params_t;
+
+#endif  // CAT_OPTS_H_
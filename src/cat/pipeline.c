@@ -0,0 +1,356 @@
+#define _GNU_SOURCE
+#include "pipeline.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "opts.h"
+#include "sstd/bits.h"
+#include "sstd/iomem.h"
+#include "sstd/utf8.h"
+
+// Read size for files which don't tell their size upfront
+#define PIPELINE_READ_SIZE (1 << 16)
+
+// Size of a piece which lasts until the end of file
+#define PIPELINE_WHOLE_FILE SIZE_MAX
+
+/*
+ * Piece of a file, either the whole file or one of its chunks
+ * */
+typedef struct {
+  const char *path;
+  off_t offset;
+  size_t size;
+  char *out;
+  size_t out_size;
+  fprint_state_t state;  // State right before this piece
+  bool hasstate;
+  bool isdone;
+  bool isfailed;
+} pipeline_task_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  pipeline_task_t *tasks;
+  size_t count;
+  size_t claimed;
+  size_t written;
+  size_t window;
+  size_t started;  // Workers which picked their NUMA node so far
+  int opts;
+  fprint_state_t end_state;
+} pipeline_t;
+
+/*
+ * Reads `task->size` bytes from `task->offset` of file, short read means the
+ * file got shorter in the meantime. `*data` of `*capacity` bytes is reused
+ * and grown when it's too small: chunks are big enough to get huge pages,
+ * and mapping one for every piece costs more than formatting it. Free it
+ * with `iomem_free` of `*capacity`.
+ * */
+static bool read_task(const pipeline_task_t *task, char **data, size_t *size,
+                      size_t *capacity) {
+  int fd = open(task->path, O_RDONLY);
+
+  if (fd == -1) {
+    return false;
+  }
+
+  ssize_t got = 0;
+  bool isok = true;
+  size_t needed = task->size != PIPELINE_WHOLE_FILE ? task->size
+                                                    : PIPELINE_READ_SIZE;
+
+  if (*data == NULL || *capacity < needed) {
+    char *grown = iomem_resize(*data, *capacity, needed, 0);
+
+    if (grown == NULL) {
+      close(fd);
+      return false;
+    }
+    *data = grown;
+    *capacity = needed;
+  }
+  *size = 0;
+
+  // NOTE: Whole pieces may come from pipes and such, which can't `pread`
+  while (*size < task->size && *capacity > 0 &&
+         (got = task->size == PIPELINE_WHOLE_FILE
+                    ? read(fd, *data + *size, *capacity - *size)
+                    : pread(fd, *data + *size, *capacity - *size,
+                            task->offset + (off_t)*size)) > 0) {
+    *size += got;
+
+    if (*size == *capacity && task->size == PIPELINE_WHOLE_FILE) {
+      char *grown = iomem_resize(*data, *capacity, *capacity * 2, *size);
+
+      if (grown == NULL) {
+        got = -1;
+        break;
+      }
+      *data = grown;
+      *capacity *= 2;
+    }
+  }
+
+  if (got == -1) {
+    isok = false;
+    *size = 0;
+  }
+
+  close(fd);
+
+  return isok;
+}
+
+/*
+ * Reads the piece `task` is about. With --utf8 characters cut by a chunk
+ * boundary go whole to the chunk they start in: every chunk reads a few bytes
+ * around itself and moves both of its boundaries past such characters.
+ * Neighbours look at the same bytes, so they agree where the boundary is.
+ *
+ * :returns: Piece is `*data + *begin` of `*size` bytes
+ * */
+static bool read_piece(const pipeline_task_t *task, int opts, char **data,
+                       size_t *begin, size_t *size, size_t *capacity) {
+  if (!HASFLAG(opts, OPT_UTF8) || task->size == PIPELINE_WHOLE_FILE) {
+    *begin = 0;
+    return read_task(task, data, size, capacity);
+  }
+
+  size_t before = task->offset < UTF8_MAX_SEQ - 1 ? (size_t)task->offset
+                                                   : UTF8_MAX_SEQ - 1;
+  pipeline_task_t padded = *task;
+  padded.offset -= (off_t)before;
+  padded.size += before + UTF8_MAX_SEQ - 1;
+
+  size_t padded_size = 0;
+  bool isread = read_task(&padded, data, &padded_size, capacity);
+  size_t start = before < padded_size ? before : padded_size;
+  size_t end = before + task->size < padded_size ? before + task->size
+                                                 : padded_size;
+
+  *begin = utf8_char_end(*data, padded_size, start);
+  end = utf8_char_end(*data, padded_size, end);
+  *size = *begin < end ? end - *begin : 0;
+
+  return isread;
+}
+
+/*
+ * Pass 1 summarizes a piece, pass 2 formats it starting from the state the
+ * previous pieces lead to. Summaries don't depend on anything, so only
+ * reconciliation of states runs in order and it's O(1) per piece.
+ *
+ * NOTE(wittenbb): Pieces are claimed in order, so the previous piece is
+ * always in work by someone and waiting for its state can't deadlock.
+ *
+ * With --numa every worker pins itself to a node first, pieces it reads
+ * then land in memory of that node.
+ * */
+static void *pipeline_worker_run(void *arg) {
+  pipeline_t *pipeline = arg;
+
+  // Buffer for all pieces of this worker, allocated after pinning
+  char *data = NULL;
+  size_t capacity = 0;
+
+  pthread_mutex_lock(&pipeline->lock);
+
+  if (HASFLAG(pipeline->opts, OPT_NUMA)) {
+    size_t index = pipeline->started++;
+    pthread_mutex_unlock(&pipeline->lock);
+    iomem_numa_pin(index);
+    pthread_mutex_lock(&pipeline->lock);
+  }
+
+  while (true) {
+    while (pipeline->claimed < pipeline->count &&
+           pipeline->claimed >= pipeline->written + pipeline->window) {
+      pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+    }
+
+    if (pipeline->claimed >= pipeline->count) {
+      break;
+    }
+
+    size_t index = pipeline->claimed++;
+    pipeline_task_t *task = pipeline->tasks + index;
+    pthread_mutex_unlock(&pipeline->lock);
+
+    size_t begin = 0, size = 0;
+    bool isread =
+        read_piece(task, pipeline->opts, &data, &begin, &size, &capacity);
+    format_summary_t summary =
+        format_summarize(data + begin, size, pipeline->opts);
+
+    // Prefix sum: our start state comes from the previous piece, the next
+    // piece starts where our summary takes it
+    pthread_mutex_lock(&pipeline->lock);
+    while (!task->hasstate) {
+      pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+    }
+
+    fprint_state_t state = task->state;
+    fprint_state_t next_state = state;
+    format_state_apply(&next_state, &summary, pipeline->opts);
+
+    if (index + 1 < pipeline->count) {
+      task[1].state = next_state;
+      task[1].hasstate = true;
+    } else {
+      pipeline->end_state = next_state;
+    }
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+
+    char *out = NULL;
+    size_t out_size = 0;
+
+    if (isread) {
+      FILE *out_stream = open_memstream(&out, &out_size);
+      fprint_buf_opts(out_stream, &state, data + begin, size, pipeline->opts);
+      fclose(out_stream);
+    }
+
+    pthread_mutex_lock(&pipeline->lock);
+    task->out = out;
+    task->out_size = out_size;
+    task->isfailed = !isread;
+    task->isdone = true;
+    pthread_cond_broadcast(&pipeline->changed);
+  }
+
+  pthread_mutex_unlock(&pipeline->lock);
+  iomem_free(data, capacity);
+
+  return NULL;
+}
+
+/*
+ * :returns: Number of pieces written to `tasks` (if not NULL)
+ * */
+static size_t plan_tasks(pipeline_task_t *tasks, const char **f_paths,
+                         size_t count) {
+  size_t task_count = 0;
+
+  for (size_t i = 0; i < count; ++i) {
+    struct stat st;
+    size_t file_size = PIPELINE_WHOLE_FILE;
+
+    if (stat(f_paths[i], &st) == 0 && S_ISREG(st.st_mode)) {
+      file_size = st.st_size;
+    }
+
+    size_t offset = 0;
+    do {
+      size_t size = PIPELINE_WHOLE_FILE;
+
+      if (file_size != PIPELINE_WHOLE_FILE) {
+        size = file_size - offset < PIPELINE_CHUNK_SIZE ? file_size - offset
+                                                        : PIPELINE_CHUNK_SIZE;
+      }
+
+      if (tasks != NULL) {
+        tasks[task_count] = (pipeline_task_t){
+            .path = f_paths[i],
+            .offset = (off_t)offset,
+            .size = size,
+        };
+      }
+
+      ++task_count;
+      offset += size;
+    } while (file_size != PIPELINE_WHOLE_FILE && offset < file_size);
+  }
+
+  return task_count;
+}
+
+int pipeline_process_files(FILE *out, const char **f_paths, size_t count,
+                           int opts, size_t job_count, fprint_state_t *state) {
+  int ret = EXIT_SUCCESS;
+  size_t task_count = plan_tasks(NULL, f_paths, count);
+  pipeline_t pipeline = {
+      .tasks = calloc(task_count, sizeof(pipeline_task_t)),
+      .count = task_count,
+      .claimed = 0,
+      .written = 0,
+      .window = job_count * PIPELINE_WINDOW_PER_JOB,
+      .started = 0,
+      .opts = opts,
+      .end_state = *state,
+  };
+  pthread_t *workers = calloc(job_count, sizeof(pthread_t));
+  size_t spawned = 0;
+
+  pthread_mutex_init(&pipeline.lock, NULL);
+  pthread_cond_init(&pipeline.changed, NULL);
+
+  plan_tasks(pipeline.tasks, f_paths, count);
+
+  if (task_count > 0) {
+    pipeline.tasks[0].state = *state;
+    pipeline.tasks[0].hasstate = true;
+  }
+
+  while (spawned < job_count &&
+         pthread_create(workers + spawned, NULL, pipeline_worker_run,
+                        &pipeline) == 0) {
+    ++spawned;
+  }
+
+  if (spawned == 0) {
+    // Nobody to overlap with, just do everything upfront
+    pipeline.window = task_count;
+    pipeline_worker_run(&pipeline);
+  }
+
+  for (size_t i = 0; i < task_count; ++i) {
+    pipeline_task_t *task = pipeline.tasks + i;
+
+    pthread_mutex_lock(&pipeline.lock);
+    while (!task->isdone) {
+      pthread_cond_wait(&pipeline.changed, &pipeline.lock);
+    }
+    pthread_mutex_unlock(&pipeline.lock);
+
+    if (task->isfailed) {
+      // Chunks of the same file would fail the same way, report it once
+      if (task->offset == 0) {
+        fprintf(stderr, "error: Failed to find file '%s'\n", task->path);
+      }
+      ret = EXIT_FAILURE;
+    } else {
+      fwrite(task->out, sizeof(char), task->out_size, out);
+    }
+
+    free(task->out);
+    task->out = NULL;
+
+    pthread_mutex_lock(&pipeline.lock);
+    ++pipeline.written;
+    pthread_cond_broadcast(&pipeline.changed);
+    pthread_mutex_unlock(&pipeline.lock);
+  }
+
+  for (size_t i = 0; i < spawned; ++i) {
+    pthread_join(workers[i], NULL);
+  }
+
+  *state = pipeline.end_state;
+
+  pthread_cond_destroy(&pipeline.changed);
+  pthread_mutex_destroy(&pipeline.lock);
+  free(workers);
+  free(pipeline.tasks);
+
+  return ret;
+}
@@ -0,0 +1,26 @@
+#ifndef CAT_PIPELINE_H_
+#define CAT_PIPELINE_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "format.h"
+
+// How many pieces may be read ahead of the one being written, per job
+#define PIPELINE_WINDOW_PER_JOB 2
+
+// Regular files bigger than that are split into chunks of that size
+#define PIPELINE_CHUNK_SIZE (1 << 22)
+
+/*
+ * Reads and formats files on `job_count` threads while the calling thread
+ * writes them to `out` strictly in the given order. `state` is carried
+ * through all files like they were printed one after another. Big files are
+ * cut into chunks, which are formatted in parallel too.
+ *
+ * :returns: EXIT_FAILURE if some file can't be read
+ * */
+int pipeline_process_files(FILE *out, const char **f_paths, size_t count,
+                           int opts, size_t job_count, fprint_state_t *state);
+
+#endif  // CAT_PIPELINE_H_
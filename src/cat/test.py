@@ -1,6 +1,6 @@
 #!/usr/bin/python3
 from __future__ import annotations
-from typing import TYPE_CHECKING, Sequence, cast
+from typing import TYPE_CHECKING, Callable, Sequence, cast
 
 if TYPE_CHECKING:
     from _typeshed import StrPath
@@ -12,11 +12,13 @@ if sys.version_info < (3, 7):
 
 import os
 import os.path
+import re
 import shlex
 import shutil
 import argparse
 import subprocess
 import itertools
+import tempfile
 import logging
 
 
@@ -50,8 +52,79 @@ flags_combinations = set()
 for i in range(len(FLAGS)):
     flags_combinations.update(itertools.combinations(FLAGS, i))
 
+# Output with --jobs must be the same as without it, so GNU cat is still
+# the reference. Big files are slow, so each flag alone and a few which
+# carry state (numbering, blank runs) over chunk edges together
+JOBS_FLAGS = "--jobs 4"
+JOBS_FLAGS_COMBINATIONS = [(flag,) for flag in FLAGS] + [
+    ("-n", "-s"),
+    ("-b", "-s", "-E"),
+    ("-A", "-n", "-s"),
+]
+
+# Pipeline cuts big files into chunks at exact multiples of this
+CHUNK_SIZE = 1 << 22
+BIG_FILE_NAME = "test_big.txt"
+
+
+def write_big_file(path: StrPath, source: StrPath):
+    """Three chunks: blank run across the first edge, odd bytes across the second"""
+    with open(source, "rb") as f:
+        text = f.read()
+
+    data = bytearray(text * (2 * CHUNK_SIZE // len(text) + 2))
+    data[CHUNK_SIZE - 3:CHUNK_SIZE + 3] = b"\n" * 6
+    data[2 * CHUNK_SIZE - 2:2 * CHUNK_SIZE + 2] = b"\t\x01\x7f\x80"
+
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+UTF8_FLAGS = "--utf8"
+
+# One byte >= 0x80 in `cat -v` output. NOTE: 0xDE is "M-^", so a '^' after
+# it would be misread, test files don't have it
+M_NOTATION = re.compile(rb"M-(\^.|.)", re.DOTALL)
+
+
+def _m_notation_byte(token: bytes) -> int:
+    if token == b"M-^?":
+        return 0xFF
+    elif token[2:3] == b"^":
+        return 0x80 + token[3] - 0x40
+    return 0x80 + token[2]
 
-def compare_proc_output(exec_a: StrPath, exec_b: StrPath, flags: Sequence[str], test_file: StrPath) -> bool:
+
+def utf8_reference(output: bytes) -> bytes:
+    """`cat -v` output with runs of M- notation spelling one valid UTF-8
+    character (but not a C1 control) turned back into that character"""
+    tokens = list(M_NOTATION.finditer(output))
+    result = bytearray()
+    pos = 0
+    i = 0
+
+    while i < len(tokens):
+        taken = 1
+        for size in (4, 3, 2):
+            run = tokens[i:i + size]
+            if len(run) < size or any(a.end() != b.start() for a, b in zip(run, run[1:])):
+                continue
+            raw = bytes(_m_notation_byte(token.group()) for token in run)
+            try:
+                char = raw.decode("utf-8")
+            except UnicodeDecodeError:
+                continue
+            if len(char) == 1 and not 0x80 <= ord(char) <= 0x9F:
+                result += output[pos:run[0].start()] + raw
+                pos = run[-1].end()
+                taken = size
+                break
+        i += taken
+
+    return bytes(result + output[pos:])
+
+
+def compare_proc_output(exec_a: StrPath, exec_b: StrPath, flags: Sequence[str], test_files: Sequence[StrPath], extra_flags: str = "", reference: Callable[[bytes], bytes] = bytes) -> bool:
     template = "{exec} {flags} {file_path}"
 
     proc_a = subprocess.run(
@@ -59,7 +132,7 @@ def compare_proc_output(exec_a: StrPath, exec_b: StrPath, flags: Sequence[str],
             template.format(
                 exec=exec_a,
                 flags=" ".join(flags),
-                file_path=shlex.quote(cast(str, test_file)),
+                file_path=" ".join(shlex.quote(cast(str, path)) for path in test_files),
             ),
         ),
         stdout=subprocess.PIPE,
@@ -70,8 +143,8 @@ def compare_proc_output(exec_a: StrPath, exec_b: StrPath, flags: Sequence[str],
         shlex.split(
             template.format(
                 exec=exec_b,
-                flags=" ".join(flags),
-                file_path=shlex.quote(cast(str, test_file)),
+                flags=" ".join([extra_flags, *flags]),
+                file_path=" ".join(shlex.quote(cast(str, path)) for path in test_files),
             ),
         ),
         stdout=subprocess.PIPE,
@@ -85,7 +158,7 @@ def compare_proc_output(exec_a: StrPath, exec_b: StrPath, flags: Sequence[str],
     logger.debug(f"A: {proc_a.stderr!s}")
     logger.debug(f"B: {proc_b.stderr!s}")
 
-    return proc_a.stdout == proc_b.stdout and proc_a.stderr == proc_b.stderr
+    return reference(proc_a.stdout) == proc_b.stdout and proc_a.stderr == proc_b.stderr
 
 def main() -> int:
     parser = argparse.ArgumentParser()
@@ -110,12 +183,37 @@ def main() -> int:
             if not os.path.isfile(test_file):
                 raise Exception(f"Test file isn't a file: file={test_file!r}")
 
-            if not compare_proc_output(cast(str, CAT_BIN), test_bin, flags, test_file):
+            if not compare_proc_output(cast(str, CAT_BIN), test_bin, flags, [test_file]):
                 failed.append((test_file, flags))
                 logger.error(f"[{index+1:3}] FAILED")
             else:
                 logger.info(f"[{index+1:3}] PASSED {flags!r}")
 
+    # GNU cat has no --utf8, its output is turned into what --utf8 prints
+    utf8_files = [path for path in test_files if "utf8" in os.path.basename(path)]
+
+    for index, flags in enumerate(flags_combinations):
+        for test_file in utf8_files:
+            if not compare_proc_output(cast(str, CAT_BIN), test_bin, flags, [test_file], UTF8_FLAGS, utf8_reference):
+                failed.append((f"{UTF8_FLAGS} {test_file}", flags))
+                logger.error(f"[{index+1:3}] FAILED {UTF8_FLAGS}")
+            else:
+                logger.info(f"[{index+1:3}] PASSED {UTF8_FLAGS} {flags!r}")
+
+    with tempfile.TemporaryDirectory() as workdir:
+        big_file = os.path.join(workdir, BIG_FILE_NAME)
+        write_big_file(big_file, test_files[-1])
+        # Files are handed out to jobs ahead, output must keep their order
+        file_packs = [[big_file], [*test_files, big_file, *test_files]]
+
+        for index, flags in enumerate(JOBS_FLAGS_COMBINATIONS):
+            for file_pack in file_packs:
+                if not compare_proc_output(cast(str, CAT_BIN), test_bin, flags, file_pack, JOBS_FLAGS):
+                    failed.append((f"{JOBS_FLAGS} {len(file_pack)} files", flags))
+                    logger.error(f"[{index+1:3}] FAILED {JOBS_FLAGS}")
+                else:
+                    logger.info(f"[{index+1:3}] PASSED {JOBS_FLAGS} {flags!r}")
+
     for (test_file, flags) in failed:
         logger.info(f"FAILED: {test_file!r} {flags!r}")
 
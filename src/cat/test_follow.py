@@ -0,0 +1,164 @@
+#!/usr/bin/python3
+from __future__ import annotations
+from typing import TYPE_CHECKING, List, Sequence
+
+if TYPE_CHECKING:
+    from _typeshed import StrPath
+
+import sys
+
+if sys.version_info < (3, 7):
+    raise Exception("python>=3.7 is required")
+
+import os
+import os.path
+import time
+import select
+import argparse
+import tempfile
+import subprocess
+import logging
+
+
+logging.basicConfig(
+    level=os.getenv("LOG_LEVEL", "INFO")
+)
+
+logger = logging.getLogger("test")
+
+
+# Follow mode polls once a second without inotify, leave room for that
+WAIT_TIMEOUT = 5.0
+QUIET_TIME = 1.5
+
+
+def _raise_if_not_exists(path: StrPath):
+    if not os.path.exists(path):
+        raise FileNotFoundError(f"Unable to find file with given path: {path!r}")
+
+
+def _write(path: StrPath, data: str, mode: str = "a"):
+    with open(path, mode) as f:
+        f.write(data)
+
+
+class Follower:
+    def __init__(self, args: Sequence[str]):
+        self.proc = subprocess.Popen(
+            args,
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+        )
+        self.pending = b""
+
+    def read_lines(self, count: int, timeout: float) -> List[str]:
+        lines = []
+        deadline = time.monotonic() + timeout
+
+        while len(lines) < count:
+            while b"\n" in self.pending and len(lines) < count:
+                line, self.pending = self.pending.split(b"\n", 1)
+                lines.append(line.decode())
+            if len(lines) == count:
+                break
+
+            left = deadline - time.monotonic()
+            if left <= 0 or not select.select([self.proc.stdout], [], [], left)[0]:
+                break
+
+            chunk = os.read(self.proc.stdout.fileno(), 4096)
+            if not chunk:
+                break
+            self.pending += chunk
+
+        return lines
+
+    def stop(self) -> bytes:
+        self.proc.terminate()
+        _, stderr = self.proc.communicate()
+        return stderr
+
+
+def expect(follower: Follower, name: str, expected: List[str]) -> bool:
+    got = follower.read_lines(len(expected), WAIT_TIMEOUT)
+    # Nothing else must show up after the expected lines
+    got += follower.read_lines(1, QUIET_TIME)
+
+    if got != expected:
+        logger.error(f"FAILED: {name}: expected {expected!r}, got {got!r}")
+        return False
+
+    logger.info(f"PASSED {name}")
+    return True
+
+
+def run_scenario(test_bin: str, workdir: str) -> List[str]:
+    log = os.path.join(workdir, "log")
+    checkpoint = os.path.join(workdir, "checkpoint")
+    args = [test_bin, "-n", "--follow", "--checkpoint", checkpoint, log]
+    failed = []
+
+    def check(follower: Follower, name: str, expected: List[str]):
+        if not expect(follower, name, expected):
+            failed.append(name)
+
+    _write(log, "one\n", "w")
+    follower = Follower(args)
+    check(follower, "start", ["     1\tone"])
+
+    _write(log, "two\n")
+    check(follower, "append", ["     2\ttwo"])
+
+    _write(log, "thr")
+    check(follower, "partial line", [])
+    _write(log, "ee\n")
+    check(follower, "partial line completed", ["     3\tthree"])
+
+    # Old file gets one more line right before it is replaced
+    _write(log, "four\n")
+    os.rename(log, log + ".1")
+    _write(log, "five\n", "w")
+    check(follower, "rotate", ["     4\tfour", "     1\tfive"])
+
+    _write(log, "six\n", "w")
+    check(follower, "truncate and rewrite", ["     1\tsix"])
+
+    # Rewritten in place past the old offset, the file never gets shorter
+    fd = os.open(log, os.O_WRONLY)
+    os.pwrite(fd, b"rewritten\nseven\n", 0)
+    os.close(fd)
+    check(follower, "rewrite in place", ["     1\trewritten", "     2\tseven"])
+
+    time.sleep(0.5)
+    stderr = follower.stop()
+    if stderr:
+        logger.error(f"FAILED: stderr: {stderr!r}")
+        failed.append("stderr")
+
+    _write(log, "eight\n")
+    follower = Follower(args)
+    check(follower, "checkpoint restart", ["     3\teight"])
+    follower.stop()
+
+    return failed
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser()
+    parser.add_argument("test_bin")
+    args = parser.parse_args()
+    test_bin: str = args.test_bin
+
+    _raise_if_not_exists(test_bin)
+
+    with tempfile.TemporaryDirectory() as workdir:
+        failed = run_scenario(os.path.abspath(test_bin), workdir)
+
+    for name in failed:
+        logger.info(f"FAILED: {name!r}")
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
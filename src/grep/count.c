@@ -0,0 +1,222 @@
+#define _GNU_SOURCE
+#include "count.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif  // __SSE2__
+
+#include "sstd/etc.h"
+#include "sstd/iomem.h"
+
+#define SWAR_ONES EXPAND(0x0101010101010101ULL)
+#define SWAR_LOW7 EXPAND(0x7F7F7F7F7F7F7F7FULL)
+
+typedef struct {
+  engine_t *engine;
+  const char *begin;
+  const char *end;
+  size_t index;
+  bool isnuma;
+  count_t count;
+  rc_t rc;
+} count_job_t;
+
+size_t count_newlines(const char *buf, size_t size) {
+  size_t count = 0, i = 0;
+
+#ifdef __SSE2__
+  const __m128i newline = _mm_set1_epi8('\n');
+
+  for (; i + 64 <= size; i += 64) {
+    const __m128i *block = (const __m128i *)(buf + i);
+    uint64_t mask =
+        (uint64_t)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128(block + 0), newline)) |
+        (uint64_t)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128(block + 1), newline))
+            << 16 |
+        (uint64_t)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128(block + 2), newline))
+            << 32 |
+        (uint64_t)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128(block + 3), newline))
+            << 48;
+    count += __builtin_popcountll(mask);
+  }
+#endif  // __SSE2__
+
+  // NOTE(wittenbb): SWAR fallback, high bit of every zero byte of `x` ends
+  // up set in `zeros` and nothing else does
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word = 0;
+    memcpy(&word, buf + i, sizeof(word));
+
+    uint64_t x = word ^ (SWAR_ONES * '\n');
+    uint64_t zeros = ~(((x & SWAR_LOW7) + SWAR_LOW7) | x | SWAR_LOW7);
+    count += __builtin_popcountll(zeros);
+  }
+
+  for (; i < size; ++i) {
+    count += buf[i] == '\n';
+  }
+
+  return count;
+}
+
+/*
+ * NOTE(wittenbb): Every job borrows its own compiled set from the engine,
+ * glibc's `regexec` holds a lock of the `regex_t` for the whole search, so
+ * shared one would serialize all threads.
+ *
+ * Readahead of the chunk is asked for by the job itself, so with --numa page
+ * cache it fills in is allocated on the job's node.
+ * */
+static void *count_job_run(void *arg) {
+  count_job_t *job = arg;
+
+  if (job->isnuma) {
+    iomem_numa_pin(job->index);
+  }
+  iomem_advise_input(job->begin, job->end - job->begin, true);
+
+  engine_set_t *set = engine_acquire(job->engine);
+
+  if (set == NULL) {
+    job->rc = RC_ERROR;
+  } else {
+    size_t chunk_size = job->end - job->begin;
+
+    job->count.lines_total = count_newlines(job->begin, chunk_size);
+    if (chunk_size > 0 && job->end[-1] != '\n') {
+      ++job->count.lines_total;
+    }
+
+    for (const char *line = job->begin; line < job->end;) {
+      const char *eol = memchr(line, '\n', job->end - line);
+      if (eol == NULL) {
+        eol = job->end;
+      }
+
+      if (engine_line_matches(set, line, eol - line)) {
+        ++job->count.lines_matched;
+      }
+
+      line = eol + 1;
+    }
+
+    engine_release(job->engine, set);
+  }
+
+  return NULL;
+}
+
+rc_t count_fd_matches(count_t *count, engine_t *engine, int fd,
+                      size_t thread_count, bool isnuma) {
+  struct stat st;
+
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    return RC_ERROR;
+  }
+
+  *count = (count_t){.lines_total = 0, .lines_matched = 0, .rc = RC_OK};
+
+  if (st.st_size == 0) {
+    return RC_OK;
+  }
+
+  size_t size = st.st_size;
+  const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (data == MAP_FAILED) {
+    return RC_ERROR;
+  }
+
+  if (thread_count == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = cpus > 0 ? (size_t)cpus : 1;
+  }
+
+  size_t job_count = size / COUNT_MIN_CHUNK_SIZE + 1;
+  if (job_count > thread_count) {
+    job_count = thread_count;
+  }
+
+  count_job_t *jobs = calloc(job_count, sizeof(count_job_t));
+  pthread_t *threads = calloc(job_count, sizeof(pthread_t));
+  bool *isspawned = calloc(job_count, sizeof(bool));
+  const char *data_end = data + size;
+  const char *begin = data;
+
+  // Chunks are cut right after '\n', so no line is split between jobs
+  for (size_t i = 0; i < job_count; ++i) {
+    const char *end = data_end;
+
+    if (i + 1 < job_count) {
+      const char *cut = data + size / job_count * (i + 1);
+      if (cut < begin) {
+        cut = begin;
+      }
+
+      const char *eol = memchr(cut, '\n', data_end - cut);
+      end = eol == NULL ? data_end : eol + 1;
+    }
+
+    jobs[i] = (count_job_t){
+        .engine = engine,
+        .begin = begin,
+        .end = end,
+        .index = i,
+        .isnuma = isnuma,
+        .count = {.lines_total = 0, .lines_matched = 0, .rc = RC_OK},
+        .rc = RC_OK,
+    };
+    begin = end;
+  }
+
+  for (size_t i = 1; i < job_count; ++i) {
+    isspawned[i] =
+        pthread_create(threads + i, NULL, count_job_run, jobs + i) == 0;
+  }
+
+  // Jobs run here pin the calling thread too, it gets its CPUs back after
+  iomem_affinity_t *affinity = isnuma ? iomem_affinity_save() : NULL;
+  rc_t rc = RC_OK;
+
+  jobs[0].isnuma = affinity != NULL;
+  count_job_run(jobs);
+
+  for (size_t i = 1; i < job_count; ++i) {
+    if (isspawned[i]) {
+      pthread_join(threads[i], NULL);
+    } else {
+      jobs[i].isnuma = affinity != NULL;
+      count_job_run(jobs + i);
+    }
+  }
+
+  iomem_affinity_restore(affinity);
+
+  for (size_t i = 0; i < job_count; ++i) {
+    if (jobs[i].rc != RC_OK) {
+      rc = jobs[i].rc;
+    }
+    count->lines_total += jobs[i].count.lines_total;
+    count->lines_matched += jobs[i].count.lines_matched;
+  }
+
+  free(isspawned);
+  free(threads);
+  free(jobs);
+  munmap((void *)data, size);
+
+  return rc;
+}
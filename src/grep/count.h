@@ -0,0 +1,33 @@
+#ifndef GREP_COUNT_H_
+#define GREP_COUNT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "engine.h"
+#include "rc.h"
+
+// Files aren't split into chunks smaller than that, threads cost more
+#define COUNT_MIN_CHUNK_SIZE (1 << 20)
+
+typedef struct {
+  size_t lines_total;
+  size_t lines_matched;
+  rc_t rc;  // RC_ERROR if some selected line couldn't be printed
+} count_t;
+
+size_t count_newlines(const char *buf, size_t size);
+
+/*
+ * Counts lines of regular file `fd` and lines with at least one match of
+ * `engine` patterns on up to `thread_count` threads (0 means one per CPU).
+ * With `isnuma` threads are spread over NUMA nodes, the calling thread runs
+ * the first chunk on the first one and is unpinned again before returning.
+ *
+ * :returns: RC_ERROR if file can't be mapped, caller should fall back to
+ *           reading it line by line
+ * */
+rc_t count_fd_matches(count_t *count, engine_t *engine, int fd,
+                      size_t thread_count, bool isnuma);
+
+#endif  // GREP_COUNT_H_
@@ -0,0 +1,687 @@
+#define _GNU_SOURCE
+#include "engine.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plan.h"
+
+/*
+ * What a set learned from the first ENGINE_SAMPLE_SIZE bytes of input about
+ * one pattern: how many lines were checked against its literals and how
+ * many of them passed.
+ * */
+typedef struct {
+  size_t lines;
+  size_t passed;
+} engine_sample_t;
+
+struct engine_set {
+  const engine_t *engine;
+  regex_t *regexes;
+  size_t count;
+  char *folded;  // Current line folded through `engine->fold`
+  size_t folded_capacity;
+  // Strategies of `engine->plans` as adapted to the current input
+  plan_strategy_t *strategies;
+  engine_sample_t *samples;
+  size_t sample_size;
+  bool issampling;
+  engine_set_t *next;
+};
+
+struct engine {
+  patterns_t patterns;
+  patterns_stats_t stats;
+  plan_t *plans;
+  unsigned char fold[UCHAR_MAX + 1];
+  bool isfolded;  // -i is done by folding lines, not by `regexec` alone
+  int regopt;
+  int flags;
+  pthread_mutex_t lock;
+  engine_set_t *idle;  // Compiled copies nobody uses right now
+};
+
+static engine_set_t *engine_set_compile(const engine_t *engine) {
+  engine_set_t *set = calloc(1, sizeof(engine_set_t));
+  set->engine = engine;
+  set->regexes = calloc(engine->patterns.count, sizeof(regex_t));
+
+  while (set->count < engine->patterns.count &&
+         regcomp(set->regexes + set->count,
+                 engine->patterns.data[set->count], engine->regopt) == 0) {
+    ++set->count;
+  }
+
+  if (set->count < engine->patterns.count) {
+    for (size_t i = 0; i < set->count; ++i) {
+      regfree(set->regexes + i);
+    }
+    free(set->regexes);
+    free(set);
+    set = NULL;
+  } else {
+    set->strategies = calloc(set->count, sizeof(plan_strategy_t));
+    set->samples = calloc(set->count, sizeof(engine_sample_t));
+    engine_set_reset(set);
+  }
+
+  return set;
+}
+
+static void engine_set_free(engine_set_t *set) {
+  for (size_t i = 0; i < set->count; ++i) {
+    regfree(set->regexes + i);
+  }
+  free(set->regexes);
+  free(set->folded);
+  free(set->strategies);
+  free(set->samples);
+  free(set);
+}
+
+/*
+ * Optimizes own copy of `patterns` and compiles the first set right away, so
+ * bad patterns are reported here rather than by the first search.
+ *
+ * :returns: RC_PATTERN_NOT_FOUND if there are no patterns, RC_ERROR if they
+ *           don't compile. `*engine` is set only on RC_OK.
+ * */
+rc_t engine_compile(engine_t **engine, const patterns_t *patterns, int flags) {
+  if (patterns->count == 0) {
+    return RC_PATTERN_NOT_FOUND;
+  }
+
+  engine_t *compiled = calloc(1, sizeof(engine_t));
+  compiled->patterns = patterns_init();
+  compiled->regopt = REG_NEWLINE | REG_EXTENDED;
+  compiled->flags = flags;
+
+  if (HASFLAG(flags, ENGINE_IGNORE_CASE)) {
+    ADDFLAG(compiled->regopt, REG_ICASE);
+  }
+
+  for (size_t i = 0; i < patterns->count; ++i) {
+    patterns_push(&compiled->patterns, patterns->data[i]);
+  }
+  compiled->stats = patterns_optimize(&compiled->patterns);
+
+  // NOTE(wittenbb): REG_ICASE folds with `tolower` of the locale of the
+  // caller, byte by byte in single byte locales, so the table is exact there.
+  // In multibyte ones a letter may be several bytes with a case counterpart
+  // of other bytes, literals can't stand for such patterns at all
+  bool isexact = !HASFLAG(flags, ENGINE_IGNORE_CASE) || MB_CUR_MAX == 1;
+  compiled->isfolded = HASFLAG(flags, ENGINE_IGNORE_CASE) && isexact;
+
+  for (size_t c = 0; c <= UCHAR_MAX; ++c) {
+    compiled->fold[c] = HASFLAG(flags, ENGINE_IGNORE_CASE)
+                            ? (unsigned char)tolower((int)c)
+                            : (unsigned char)c;
+  }
+
+  compiled->plans = calloc(compiled->patterns.count, sizeof(plan_t));
+  for (size_t i = 0; i < compiled->patterns.count; ++i) {
+    compiled->plans[i] =
+        plan_init(compiled->patterns.data[i],
+                  isexact ? compiled->fold : NULL, compiled->isfolded);
+  }
+
+  pthread_mutex_init(&compiled->lock, NULL);
+  compiled->idle = engine_set_compile(compiled);
+
+  if (compiled->idle == NULL) {
+    engine_free(compiled);
+    return RC_ERROR;
+  }
+
+  *engine = compiled;
+
+  return RC_OK;
+}
+
+void engine_free(engine_t *engine) {
+  if (engine == NULL) {
+    return;
+  }
+
+  while (engine->idle != NULL) {
+    engine_set_t *next = engine->idle->next;
+    engine_set_free(engine->idle);
+    engine->idle = next;
+  }
+
+  for (size_t i = 0; engine->plans != NULL && i < engine->patterns.count;
+       ++i) {
+    plan_free(engine->plans + i);
+  }
+  free(engine->plans);
+
+  pthread_mutex_destroy(&engine->lock);
+  patterns_free(&engine->patterns);
+  free(engine);
+}
+
+const patterns_stats_t *engine_stats(const engine_t *engine) {
+  return &engine->stats;
+}
+
+/*
+ * Prints plan of every pattern, see plan.h.
+ * */
+void engine_explain(const engine_t *engine, FILE *out) {
+  const char *fold_note = "";
+
+  if (engine->isfolded) {
+    fold_note = ", lines folded";
+  } else if (HASFLAG(engine->flags, ENGINE_IGNORE_CASE)) {
+    fold_note = ", case left to regex (multibyte locale)";
+  }
+
+  fprintf(out, "plan: %zu pattern(s)%s\n", engine->patterns.count,
+          fold_note);
+
+  for (size_t i = 0; i < engine->patterns.count; ++i) {
+    const plan_t *plan = engine->plans + i;
+
+    fprintf(out, "  #%zu %s -> %s, cost %.1f/byte", i + 1,
+            plan_class_name(plan->class), plan_strategy_name(plan->strategy),
+            plan->cost);
+    if (plan->prefix != NULL) {
+      fprintf(out, ", prefix \"%s\"", plan->prefix);
+    }
+    if (plan->count > 0) {
+      fprintf(out, ", %zu literal(s) passing %.1f%% of lines (estimate)",
+              plan->count, plan->pass_rate * 100);
+    }
+    fprintf(out, ": %s\n", engine->patterns.data[i]);
+  }
+}
+
+/*
+ * Prints strategies which `set` switched to after sampling the input.
+ * */
+void engine_explain_set(const engine_set_t *set, FILE *out,
+                        const char *label) {
+  for (size_t i = 0; i < set->count; ++i) {
+    const plan_t *plan = set->engine->plans + i;
+    const engine_sample_t *sample = set->samples + i;
+
+    if (!set->issampling && sample->lines > 0 &&
+        set->strategies[i] != plan->strategy) {
+      fprintf(out,
+              "plan: %s: #%zu %s -> %s, %.1f%% of %zu sampled lines passed\n",
+              label, i + 1, plan_strategy_name(plan->strategy),
+              plan_strategy_name(set->strategies[i]),
+              100.0 * sample->passed / sample->lines, sample->lines);
+    }
+  }
+}
+
+/*
+ * Starts over with the planned strategies, sampling the next
+ * ENGINE_SAMPLE_SIZE bytes of input. Should be called at the start of every
+ * input, `engine_acquire` does it on its own.
+ * */
+void engine_set_reset(engine_set_t *set) {
+  set->sample_size = 0;
+  set->issampling = false;
+
+  for (size_t i = 0; i < set->count; ++i) {
+    const plan_t *plan = set->engine->plans + i;
+
+    set->strategies[i] = plan->strategy;
+    set->samples[i] = (engine_sample_t){.lines = 0, .passed = 0};
+    set->issampling = set->issampling ||
+                      (!plan->isscannable && plan_hasprefilter(plan));
+  }
+}
+
+/*
+ * Picks strategies again with pass rates measured on the sample instead of
+ * estimated ones.
+ * */
+static void engine_set_adapt(engine_set_t *set) {
+  for (size_t i = 0; i < set->count; ++i) {
+    const engine_sample_t *sample = set->samples + i;
+    double cost = 0;
+
+    if (sample->lines > 0) {
+      set->strategies[i] =
+          plan_pick(set->engine->plans + i,
+                    (double)sample->passed / sample->lines, &cost);
+    }
+  }
+
+  set->issampling = false;
+}
+
+static FORCE_INLINE void engine_set_account(engine_set_t *set, size_t size) {
+  if (set->issampling) {
+    set->sample_size += size + 1;
+    if (set->sample_size >= ENGINE_SAMPLE_SIZE) {
+      engine_set_adapt(set);
+    }
+  }
+}
+
+/*
+ * Hands out an idle compiled set or compiles a new one, so there are never
+ * more sets than threads searching at the same time.
+ *
+ * :returns: NULL if patterns failed to compile
+ * */
+engine_set_t *engine_acquire(engine_t *engine) {
+  pthread_mutex_lock(&engine->lock);
+  engine_set_t *set = engine->idle;
+  if (set != NULL) {
+    engine->idle = set->next;
+  }
+  pthread_mutex_unlock(&engine->lock);
+
+  if (set == NULL) {
+    set = engine_set_compile(engine);
+  } else {
+    engine_set_reset(set);
+  }
+
+  return set;
+}
+
+void engine_release(engine_t *engine, engine_set_t *set) {
+  pthread_mutex_lock(&engine->lock);
+  set->next = engine->idle;
+  engine->idle = set;
+  pthread_mutex_unlock(&engine->lock);
+}
+
+/*
+ * Finds the leftmost match in `line[off, size)`, offsets in `match` are
+ * relative to `line`.
+ * */
+static bool engine_exec(const regex_t *regex, const char *line, size_t size,
+                        size_t off, int eflags, regmatch_t *match) {
+  // NOTE(wittenbb): With REG_NEWLINE `^` matches right after the trailing
+  // '\n' too, `^x*$` would then match every line at its very end
+  if (size > 0 && line[size - 1] == '\n') {
+    --size;
+  }
+  if (off > size) {
+    return false;
+  }
+
+#ifdef REG_STARTEND
+  match->rm_so = (regoff_t)off;
+  match->rm_eo = (regoff_t)size;
+  return regexec(regex, line, 1, match, REG_STARTEND | eflags) == 0;
+#else
+  // NOTE(wittenbb): Without REG_STARTEND `regexec` wants nullterminated
+  // string, so copy the rest of the line
+  char *str = calloc(size - off + 1, sizeof(char));
+  memcpy(str, line + off, size - off);
+
+  bool ismatch =
+      regexec(regex, str, 1, match, (off > 0 ? REG_NOTBOL : 0) | eflags) == 0;
+  if (ismatch) {
+    match->rm_so += off;
+    match->rm_eo += off;
+  }
+
+  free(str);
+  return ismatch;
+#endif  // REG_STARTEND
+}
+
+/*
+ * :returns: Line folded through `engine->fold`, done once per line
+ * */
+static const char *engine_set_fold(engine_set_t *set, const char *line,
+                                   size_t size) {
+  const unsigned char *fold = set->engine->fold;
+
+  if (set->folded_capacity < size + 1) {
+    free(set->folded);
+    set->folded_capacity = size + 1;
+    set->folded = malloc(set->folded_capacity);
+  }
+
+  for (size_t i = 0; i < size; ++i) {
+    set->folded[i] = fold[(unsigned char)line[i]];
+  }
+
+  return set->folded;
+}
+
+static FORCE_INLINE const char *engine_set_haystack(engine_set_t *set,
+                                                    const char *line,
+                                                    size_t size,
+                                                    const char **haystack) {
+  if (*haystack == NULL) {
+    *haystack = set->engine->isfolded ? engine_set_fold(set, line, size)
+                                      : line;
+  }
+  return *haystack;
+}
+
+/*
+ * Cheap check whether `i`th pattern can match the line at all, `regexec`
+ * runs only for lines which pass it. While sampling it's done for every
+ * pattern with literals to measure how many lines pass.
+ *
+ * :param haystack: Line as it's seen by literals, folded on demand
+ * */
+static bool engine_prefilter_pass(engine_set_t *set, size_t i,
+                                  const char *line, size_t size,
+                                  const char **haystack) {
+  const plan_t *plan = set->engine->plans + i;
+  bool issampled =
+      set->issampling && !plan->isscannable && plan_hasprefilter(plan);
+  bool ispassed = !issampled && set->strategies[i] != PLAN_PREFILTER;
+
+  if (!ispassed) {
+    engine_set_haystack(set, line, size, haystack);
+  }
+
+  for (size_t j = 0; !ispassed && j < plan->count; ++j) {
+    ispassed = memmem(*haystack, size, plan->literals.data[j],
+                      plan->sizes[j]) != NULL;
+  }
+
+  if (issampled) {
+    ++set->samples[i].lines;
+    set->samples[i].passed += ispassed;
+  }
+
+  return ispassed;
+}
+
+/*
+ * Leftmost (then longest) match of alternatives of scannable `plan` in
+ * `haystack[off, size)`, the same one `regexec` would find. Patterns are
+ * compiled with REG_NEWLINE, so `$` matches before the trailing '\n' too.
+ * */
+static bool engine_scan(const plan_t *plan, const char *haystack, size_t size,
+                        size_t off, bool isline_end, regmatch_t *match) {
+  bool hasnewline = size > 0 && haystack[size - 1] == '\n';
+  bool hasend = hasnewline || isline_end;
+  size_t end = hasnewline ? size - 1 : size;
+  bool isfound = false;
+
+  for (size_t j = 0; j < plan->count; ++j) {
+    const char *literal = plan->literals.data[j];
+    size_t literal_size = plan->sizes[j];
+    int anchors = plan->anchors[j];
+    const char *hit = NULL;
+
+    if (literal_size > size || off > size - literal_size) {
+      continue;
+    } else if (HASFLAG(anchors, PLAN_ANCHOR_BEGIN)) {
+      bool isend_ok = !HASFLAG(anchors, PLAN_ANCHOR_END) ||
+                      (hasend && literal_size == end);
+      hit = off == 0 && isend_ok && memcmp(haystack, literal, literal_size) == 0
+                ? haystack
+                : NULL;
+    } else if (HASFLAG(anchors, PLAN_ANCHOR_END)) {
+      const char *tail = haystack + end - literal_size;
+      hit = hasend && literal_size <= end && tail >= haystack + off &&
+                    memcmp(tail, literal, literal_size) == 0
+                ? tail
+                : NULL;
+    } else {
+      hit = memmem(haystack + off, size - off, literal, literal_size);
+    }
+
+    regoff_t so = hit != NULL ? (regoff_t)(hit - haystack) : 0;
+    if (hit != NULL &&
+        (!isfound || so < match->rm_so ||
+         (so == match->rm_so && so + (regoff_t)literal_size > match->rm_eo))) {
+      match->rm_so = so;
+      match->rm_eo = so + (regoff_t)literal_size;
+      isfound = true;
+    }
+  }
+
+  return isfound;
+}
+
+/*
+ * Finds the leftmost match of `i`th pattern in `line[off, size)` the way
+ * its current strategy says.
+ * */
+static bool engine_pattern_exec(engine_set_t *set, size_t i, const char *line,
+                                size_t size, const char **haystack, size_t off,
+                                int eflags, regmatch_t *match) {
+  const plan_t *plan = set->engine->plans + i;
+  plan_strategy_t strategy = set->strategies[i];
+  bool ismatch = false;
+
+  if (strategy == PLAN_SCAN) {
+    ismatch = engine_scan(plan, engine_set_haystack(set, line, size, haystack),
+                          size, off, !HASFLAG(eflags, REG_NOTEOL), match);
+  } else if (strategy == PLAN_SEEK) {
+    const char *hay = engine_set_haystack(set, line, size, haystack);
+    const char *hit =
+        off < size
+            ? memmem(hay + off, size - off, plan->prefix, plan->prefix_size)
+            : NULL;
+    ismatch = hit != NULL && engine_exec(set->regexes + i, line, size,
+                                         hit - hay, eflags, match);
+  } else {
+    ismatch = engine_exec(set->regexes + i, line, size, off, eflags, match);
+  }
+
+  return ismatch;
+}
+
+/*
+ * Collects matches of every pattern in `line`, matches of different patterns
+ * come unordered and may overlap.
+ *
+ * :returns: Number of matches written to `matches`
+ * */
+size_t engine_match_line(engine_set_t *set, const char *line, size_t size,
+                         regmatch_t *matches, size_t max_matches) {
+  return engine_match_window(set, line, size, 0, true, matches, max_matches);
+}
+
+/*
+ * Same as `engine_match_line`, but only for matches starting at `from` or
+ * later. Whatever is before `from` still counts as context for anchors, and
+ * `$` doesn't match at the end of window unless `isline_end`.
+ * */
+size_t engine_match_window(engine_set_t *set, const char *window, size_t size,
+                           size_t from, bool isline_end, regmatch_t *matches,
+                           size_t max_matches) {
+  const char *haystack = NULL;
+  size_t match_count = 0;
+  int eflags = isline_end ? 0 : REG_NOTEOL;
+
+  for (size_t i = 0; match_count < max_matches && i < set->count; ++i) {
+    size_t search_off = from;
+
+    if (!engine_prefilter_pass(set, i, window, size, &haystack)) {
+      continue;
+    }
+
+    while (match_count < max_matches && search_off <= size &&
+           engine_pattern_exec(set, i, window, size, &haystack, search_off,
+                               eflags, matches + match_count)) {
+      regmatch_t *match = matches + match_count;
+      search_off = match->rm_eo;
+
+      // NOTE(wittenbb): Empty match would be found at the same place over and
+      // over, step past it. It colors nothing, so one is enough to select line
+      if (match->rm_so == match->rm_eo) {
+        ++search_off;
+        if (match_count > 0) {
+          continue;
+        }
+      }
+
+      ++match_count;
+    }
+  }
+
+  engine_set_account(set, size);
+
+  return match_count;
+}
+
+static int compare_leftmost_longest(const void *a, const void *b) {
+  const engine_span_t *a_span = a, *b_span = b;
+
+  if (a_span->so != b_span->so) {
+    return (a_span->so > b_span->so) - (a_span->so < b_span->so);
+  }
+
+  return (a_span->eo < b_span->eo) - (a_span->eo > b_span->eo);
+}
+
+/*
+ * Leftmost first, then longest first of those starting at the same place.
+ * */
+void engine_sort_spans(engine_span_t *spans, size_t span_count) {
+  qsort(spans, span_count, sizeof(engine_span_t), compare_leftmost_longest);
+}
+
+/*
+ * Leaves only matches which are printed on their own (`-o`): non-empty and
+ * not overlapping. The leftmost one wins, then the longest of those starting
+ * at the same place, same as one search for all patterns at once would do.
+ *
+ * :returns: Number of spans left at the beginning of `spans`, in order
+ * */
+size_t engine_disjoint_spans(engine_span_t *spans, size_t span_count) {
+  size_t kept = 0;
+  unsigned long long end = 0;
+
+  engine_sort_spans(spans, span_count);
+
+  for (size_t i = 0; i < span_count; ++i) {
+    if (spans[i].so < spans[i].eo && spans[i].so >= end) {
+      end = spans[i].eo;
+      spans[kept++] = spans[i];
+    }
+  }
+
+  return kept;
+}
+
+/*
+ * `engine_disjoint_spans` for at most ENGINE_MAX_MATCHES `regmatch_t`.
+ * */
+size_t engine_disjoint_matches(regmatch_t *matches, size_t match_count) {
+  engine_span_t spans[ENGINE_MAX_MATCHES];
+
+  match_count = match_count < ENGINE_MAX_MATCHES ? match_count
+                                                 : ENGINE_MAX_MATCHES;
+  for (size_t i = 0; i < match_count; ++i) {
+    spans[i].so = (unsigned long long)matches[i].rm_so;
+    spans[i].eo = (unsigned long long)matches[i].rm_eo;
+  }
+
+  match_count = engine_disjoint_spans(spans, match_count);
+
+  for (size_t i = 0; i < match_count; ++i) {
+    matches[i].rm_so = (regoff_t)spans[i].so;
+    matches[i].rm_eo = (regoff_t)spans[i].eo;
+  }
+
+  return match_count;
+}
+
+bool engine_line_matches(engine_set_t *set, const char *line, size_t size) {
+  const char *haystack = NULL;
+  bool hasmatch = false;
+
+  for (size_t i = 0; !hasmatch && i < set->count; ++i) {
+    if (!engine_prefilter_pass(set, i, line, size, &haystack)) {
+      continue;
+    }
+
+    if (set->strategies[i] == PLAN_SCAN || set->strategies[i] == PLAN_SEEK) {
+      regmatch_t match;
+      hasmatch =
+          engine_pattern_exec(set, i, line, size, &haystack, 0, 0, &match);
+    } else {
+#ifdef REG_STARTEND
+      regmatch_t bounds = {.rm_so = 0, .rm_eo = (regoff_t)size};
+      hasmatch =
+          regexec(set->regexes + i, line, 0, &bounds, REG_STARTEND) == 0;
+#else
+      regmatch_t match;
+      hasmatch = engine_exec(set->regexes + i, line, size, 0, 0, &match);
+#endif  // REG_STARTEND
+    }
+  }
+
+  engine_set_account(set, size);
+
+  return hasmatch;
+}
+
+/*
+ * Passes every selected line of `buf` to `sink`, NULL `sink` just counts
+ * them. Safe to call from any number of threads with the same `engine`.
+ *
+ * :returns: RC_ERROR if patterns failed to compile for this thread
+ * */
+rc_t engine_search_buf(engine_t *engine, const char *buf, size_t size,
+                       engine_sink_t sink, void *user_data, size_t *selected) {
+  engine_set_t *set = engine_acquire(engine);
+  bool isinverted = HASFLAG(engine->flags, ENGINE_INVERT_MATCH);
+  regmatch_t *matches =
+      sink != NULL ? malloc(ENGINE_MAX_MATCHES * sizeof(regmatch_t)) : NULL;
+  size_t line_number = 0;
+  bool isdone = false;
+
+  *selected = 0;
+
+  if (set == NULL) {
+    free(matches);
+    return RC_ERROR;
+  }
+
+  for (size_t off = 0; !isdone && off < size;) {
+    const char *line = buf + off;
+    const char *eol = memchr(line, '\n', size - off);
+    size_t line_size = eol != NULL ? (size_t)(eol - line) : size - off;
+    size_t match_count = 0;
+    bool isselected = false;
+
+    ++line_number;
+
+    if (sink == NULL) {
+      isselected = engine_line_matches(set, line, line_size) != isinverted;
+    } else {
+      match_count = engine_match_line(set, line, line_size, matches,
+                                      ENGINE_MAX_MATCHES);
+      isselected = (match_count > 0) != isinverted;
+    }
+
+    if (isselected) {
+      ++(*selected);
+    }
+
+    if (isselected && sink != NULL) {
+      engine_match_t match = {
+          .line = line,
+          .size = line_size,
+          .line_number = line_number,
+          .offset = off,
+          .matches = matches,
+          .match_count = isinverted ? 0 : match_count,
+      };
+      isdone = !sink(&match, user_data);
+    }
+
+    off += line_size + 1;
+  }
+
+  free(matches);
+  engine_release(engine, set);
+
+  return RC_OK;
+}
@@ -0,0 +1,97 @@
+#ifndef GREP_ENGINE_H_
+#define GREP_ENGINE_H_
+
+/*
+ * Search engine of s21_grep, also built as libs21grep (static and shared).
+ *
+ * Engine is compiled once from a pattern set and then shared between any
+ * number of threads. Every thread borrows its own compiled copy of patterns
+ * (`engine_set_t`), glibc's `regexec` locks `regex_t` for the whole search,
+ * so threads sharing one copy would be serialized.
+ *
+ * Nothing here touches global state (`optind`, stdout and such), results are
+ * handed to a callback.
+ * */
+
+#include <regex.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "patterns.h"
+#include "rc.h"
+#include "sstd/bits.h"
+
+#ifdef CONFIG_DEBUG
+#define ENGINE_MAX_MATCHES 32
+#else
+#define ENGINE_MAX_MATCHES 2048  // 256
+#endif                           // CONFIG_DEBUG
+
+// Strategies are picked again once a set has seen that much of input
+#define ENGINE_SAMPLE_SIZE (1 << 20)
+
+#define ENGINE_IGNORE_CASE MKFLAG(0)
+#define ENGINE_INVERT_MATCH MKFLAG(1)
+
+typedef struct engine engine_t;
+typedef struct engine_set engine_set_t;
+
+/*
+ * Selected line passed to `engine_sink_t`. `line` isn't nullterminated and
+ * has no '\n', `matches` are relative to `line` and are empty with
+ * ENGINE_INVERT_MATCH.
+ * */
+typedef struct {
+  const char *line;
+  size_t size;
+  size_t line_number;
+  size_t offset;
+  const regmatch_t *matches;
+  size_t match_count;
+} engine_match_t;
+
+/*
+ * Match as offsets which, unlike `regoff_t`, fit lines of any size (see
+ * --max-line-buffer).
+ * */
+typedef struct {
+  unsigned long long so;
+  unsigned long long eo;
+} engine_span_t;
+
+/*
+ * :returns: false to stop the search
+ * */
+typedef bool (*engine_sink_t)(const engine_match_t *match, void *user_data);
+
+GREP_API rc_t engine_compile(engine_t **engine, const patterns_t *patterns,
+                            int flags);
+GREP_API void engine_free(engine_t *engine);
+GREP_API const patterns_stats_t *engine_stats(const engine_t *engine);
+GREP_API void engine_explain(const engine_t *engine, FILE *out);
+
+GREP_API engine_set_t *engine_acquire(engine_t *engine);
+GREP_API void engine_release(engine_t *engine, engine_set_t *set);
+GREP_API void engine_set_reset(engine_set_t *set);
+GREP_API void engine_explain_set(const engine_set_t *set, FILE *out,
+                                 const char *label);
+
+GREP_API size_t engine_match_line(engine_set_t *set, const char *line,
+                                  size_t size, regmatch_t *matches,
+                                  size_t max_matches);
+GREP_API size_t engine_match_window(engine_set_t *set, const char *window,
+                                    size_t size, size_t from, bool isline_end,
+                                    regmatch_t *matches, size_t max_matches);
+GREP_API bool engine_line_matches(engine_set_t *set, const char *line,
+                                  size_t size);
+GREP_API void engine_sort_spans(engine_span_t *spans, size_t span_count);
+GREP_API size_t engine_disjoint_spans(engine_span_t *spans, size_t span_count);
+GREP_API size_t engine_disjoint_matches(regmatch_t *matches,
+                                        size_t match_count);
+
+GREP_API rc_t engine_search_buf(engine_t *engine, const char *buf, size_t size,
+                                engine_sink_t sink, void *user_data,
+                                size_t *selected);
+
+#endif  // GREP_ENGINE_H_
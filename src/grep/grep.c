@@ -4,8 +4,12 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 // TODO: Replace with appropriate macro from std
@@ -22,29 +26,36 @@
 
 #endif  // REG_NOERROR
 
+#ifndef SSTD_FOLLOW_IMPL
+#define SSTD_FOLLOW_IMPL
+#endif  // SSTD_FOLLOW_IMPL
+
+#ifndef SSTD_UTF8_IMPL
+#define SSTD_UTF8_IMPL
+#endif  // SSTD_UTF8_IMPL
+
 #ifndef SSTD_MEMORY_IMPL
 #define SSTD_MEMORY_IMPL
 #endif  // SSTD_MEMORY_IMPL
 
+#ifndef SSTD_IOMEM_IMPL
+#define SSTD_IOMEM_IMPL
+#endif  // SSTD_IOMEM_IMPL
+
+#include "count.h"
+#include "engine.h"
+#include "json.h"
+#include "opts.h"
 #include "patterns.h"
 #include "rc.h"
+#include "reader.h"
+#include "server.h"
 #include "sstd/memory.h"
 #include "sstd/bits.h"
 #include "sstd/color.h"
-
-#define OPT_NONE EXPAND(0)
-#define OPT_HELP MKFLAG(1)
-#define OPT_REGEXP MKFLAG(2)
-#define OPT_FILE MKFLAG(3)
-#define OPT_IGNORE_CASE MKFLAG(4)
-#define OPT_INVERT_MATCH MKFLAG(5)
-#define OPT_COUNT MKFLAG(6)
-#define OPT_FILES_WITH_MATCHES MKFLAG(7)
-#define OPT_ONLY_MATCHING MKFLAG(8)
-#define OPT_NO_MESSAGES MKFLAG(9)
-#define OPT_LINE_NUMBER MKFLAG(10)
-#define OPT_NO_FILENAME MKFLAG(11)
-#define OPT_NO_COLOR MKFLAG(12)
+#include "sstd/follow.h"
+#include "sstd/iomem.h"
+#include "sstd/utf8.h"
 
 #define MAKE_FLAG_OPT(__NAME, __OPT) \
   { (__NAME), no_argument, NULL, (__OPT) }
@@ -52,66 +63,154 @@
 #define MAKE_PARAM_OPT(__NAME, __OPT) \
   { (__NAME), required_argument, NULL, (__OPT) }
 
-#define MATCH_COLOR ANSI_BOLD_RED
-#define FILENAME_COLOR ANSI_BOLD_PURPLE
-#define LINENUM_COLOR ANSI_GREEN
-#define LINESEP_COLOR ANSI_CYAN
-
-#ifdef CONFIG_DEBUG
-#define MAX_MATCHES 32
-#else
-#define MAX_MATCHES 2048  // 256
-#endif                    // CONFIG_DEBUG
-
-typedef unsigned int optmask_t;
-typedef int regopt_t;
-
-static void print_matches(optmask_t optmask, const char *line,
-                          regmatch_t *matches, size_t match_count,
-                          size_t line_number);
+// Flags tested for every line, the search loop is specialized for their
+// common combinations
+#define SEARCH_LOOP_MASK                                              \
+  EXPAND(OPT_INVERT_MATCH | OPT_COUNT | OPT_FILES_WITH_MATCHES |      \
+         OPT_LINE_NUMBER | OPT_NO_FILENAME | OPT_NO_COLOR |           \
+         OPT_BYTE_OFFSET | OPT_JSON | OPT_UTF8 | OPT_ONLY_MATCHING)
+
+// Nothing is printed per line with those, only lines are counted
+#define SEARCH_LOOP_QUIET_MASK EXPAND(OPT_COUNT | OPT_FILES_WITH_MATCHES)
+
+// `-l` stops at the first selected line, which `-v` changes
+#define SEARCH_LOOP_QUIET_KEY_MASK \
+  EXPAND(SEARCH_LOOP_QUIET_MASK | OPT_INVERT_MATCH)
+
+// X(__NAME, __OPTMASK): `search_loop_<__NAME>` is compiled with `__OPTMASK`
+// known in advance, anything else goes to `search_loop_generic`
+#define SEARCH_LOOPS(X)                                                 \
+  X(plain, OPT_NO_COLOR | OPT_NO_FILENAME)                              \
+  X(plain_named, OPT_NO_COLOR)                                          \
+  X(numbered, OPT_NO_COLOR | OPT_NO_FILENAME | OPT_LINE_NUMBER)         \
+  X(numbered_named, OPT_NO_COLOR | OPT_LINE_NUMBER)                     \
+  X(inverted, OPT_NO_COLOR | OPT_NO_FILENAME | OPT_INVERT_MATCH)        \
+  X(inverted_named, OPT_NO_COLOR | OPT_INVERT_MATCH)                    \
+  X(colored, OPT_NO_FILENAME)                                           \
+  X(colored_named, OPT_NONE)                                            \
+  X(colored_numbered, OPT_NO_FILENAME | OPT_LINE_NUMBER)                \
+  X(colored_numbered_named, OPT_LINE_NUMBER)                            \
+  X(counted, OPT_COUNT)                                                 \
+  X(listed, OPT_FILES_WITH_MATCHES)                                     \
+  X(counted_listed, OPT_COUNT | OPT_FILES_WITH_MATCHES)                 \
+  X(json, OPT_NO_COLOR | OPT_NO_FILENAME | OPT_JSON)                    \
+  X(json_named, OPT_NO_COLOR | OPT_JSON)                                \
+  X(only_matching, OPT_NO_COLOR | OPT_NO_FILENAME | OPT_ONLY_MATCHING)  \
+  X(only_matching_named, OPT_NO_COLOR | OPT_ONLY_MATCHING)
+
+typedef count_t (*search_loop_t)(engine_set_t *set, optmask_t optmask,
+                                 const params_t *params, FILE *file,
+                                 const char *file_path);
+
+/*
+ * State every file found by `walk_paths` is searched with, `rc` sums up
+ * results of all of them (see `merge_search_rc`).
+ * */
+typedef struct {
+  engine_t *engine;
+  engine_set_t *set;
+  optmask_t optmask;
+  const params_t *params;
+  search_loop_t search_loop;
+  rc_t compile_rc;  // Files aren't searched unless it's RC_OK
+  rc_t rc;
+} search_t;
+
+/*
+ * Line which didn't fit in --max-line-buffer. It's never whole in memory, so
+ * matches are kept as offsets into the line and it's printed by reading it
+ * from file again.
+ * */
+typedef struct {
+  unsigned long long offset;
+  unsigned long long size;
+  bool hasnewline;
+  bool hasmatches;
+  engine_span_t matches[ENGINE_MAX_MATCHES];
+  size_t match_count;
+} cut_line_t;
+
+static FORCE_INLINE void print_line_prefix(optmask_t optmask,
+                                           size_t line_number,
+                                           unsigned long long offset);
+static FORCE_INLINE void print_matches(optmask_t optmask, const line_t *line,
+                                       regmatch_t *matches, size_t match_count,
+                                       size_t line_number);
+static void print_json_matches(const line_t *line, const regmatch_t *matches,
+                               size_t match_count, size_t line_number,
+                               const char *file_path);
+static FORCE_INLINE void print_only_matching(optmask_t optmask,
+                                             const line_t *line,
+                                             regmatch_t *matches,
+                                             size_t match_count,
+                                             size_t line_number,
+                                             const char *file_path);
 
 static void print_short_usage(void);
 static void print_help(void);
 
-static char *alloc_str_from_buf(const char *s, size_t size);
-
-static regopt_t make_from_optmask(optmask_t optmask);
-
-static rc_t alloc_regexes_and_compile(regex_t **regexes,
-                                      const patterns_t *patterns,
-                                      optmask_t optmask);
+static int make_engine_flags(optmask_t optmask);
+static rc_t search_files(const patterns_t *patterns, optmask_t optmask,
+                         const params_t *params, int argc, char **argv);
 
-static size_t search_line_for_matches(regmatch_t *matches,
-                                      const regex_t *regexes,
-                                      const patterns_t *patterns,
-                                      const char *line_buffer,
-                                      size_t line_buffer_size);
+static void print_patterns_stats(const patterns_stats_t *stats,
+                                 double compile_ms);
 
-static rc_t search_file_for_matches(const patterns_t *patterns,
-                                    optmask_t optmask, FILE *file,
+static search_loop_t pick_search_loop(optmask_t optmask);
+static void search_path(int dir_fd, const char *name, const char *file_path,
+                        void *user_data);
+static rc_t search_file_for_matches(engine_set_t *set, optmask_t optmask,
+                                    const params_t *params,
+                                    search_loop_t search_loop, FILE *file,
                                     const char *file_path);
+static void search_cut_line(engine_set_t *set, optmask_t optmask,
+                            reader_t *reader, line_t *line, cut_line_t *cut);
+static rc_t print_cut_line_if_should(optmask_t optmask, int fd,
+                                     cut_line_t *cut, size_t line_number,
+                                     size_t *line_matched,
+                                     const char *file_path);
+static rc_t count_file_for_matches(engine_t *engine, optmask_t optmask,
+                                   const params_t *params, FILE *file,
+                                   const char *file_path);
+static void search_file_tail_for_matches(engine_set_t *set, optmask_t optmask,
+                                         int fd, follow_entry_t *entry);
+static rc_t follow_files_for_matches(engine_set_t *set, optmask_t optmask,
+                                     const params_t *params, char **file_paths,
+                                     size_t file_count);
 static rc_t process_argsleft(patterns_t *patterns, optmask_t optmask,
                              int argsleft, FILE **file, char **argv,
                              const char **file_path);
 static rc_t gather_optmask_and_patterns(optmask_t *optmask,
-                                        patterns_t *patterns, int argc,
-                                        char **argv, int *argsleft);
+                                        patterns_t *patterns, params_t *params,
+                                        int argc, char **argv, int *argsleft);
+static bool parse_size(const char *s, size_t *size);
 
-static void print_line_count_if_should(optmask_t optmask, size_t line_matched,
-                                       size_t lines_total,
+static size_t count_selected(optmask_t optmask, const count_t *count);
+
+static void print_line_count_if_should(optmask_t optmask, size_t line_selected,
                                        const char *const file_path);
 
 static void print_filename_with_matches_if_should(optmask_t optmask,
                                                   const char *const file_path,
-                                                  size_t line_matched);
+                                                  size_t line_selected);
 
 static void fclose_if_not_null(FILE *file);
+static bool is_directory(const char *path);
+static void collect_path(int dir_fd, const char *name, const char *path,
+                         void *user_data);
 
 int main(int argc, char **argv) {
   rc_t rc = RC_OK;
   optmask_t optmask = OPT_NONE;
   patterns_t patterns = patterns_init();
-
+  params_t params = {
+      .checkpoint_path = NULL,
+      .thread_count = 0,
+      .serve_path = NULL,
+      .client_path = NULL,
+      .max_line_buffer = 0,
+      .walk = walk_init(),
+  };
   const char *file_path = NULL;
   FILE *file = NULL;
   int argsleft = 0;
@@ -120,27 +219,49 @@ int main(int argc, char **argv) {
     ADDFLAG(optmask, OPT_NO_COLOR);
   }
 
-  if (gather_optmask_and_patterns(&optmask, &patterns, argc, argv, &argsleft) ==
-      RC_OK) {
+  if (gather_optmask_and_patterns(&optmask, &patterns, &params, argc, argv,
+                                  &argsleft) == RC_OK) {
+    params.walk.isrecursive = HASFLAG(optmask, OPT_RECURSIVE);
+    params.walk.isquiet = HASFLAG(optmask, OPT_NO_MESSAGES);
+
     if (HASFLAG(optmask, OPT_HELP)) {
       print_help();
+    } else if (HASFLAG(optmask, OPT_FOLLOW) &&
+               HASFLAG(optmask, OPT_COUNT | OPT_FILES_WITH_MATCHES)) {
+      fprintf(stderr, "error: --follow can't be combined with -c or -l\n");
+      rc = RC_ERROR;
+    } else if (params.client_path != NULL &&
+               (HASFLAG(optmask, OPT_FOLLOW | OPT_EXPLAIN | OPT_VERBOSE) ||
+                params.checkpoint_path != NULL)) {
+      // Server answers one query and keeps its statistics to itself
+      fprintf(stderr,
+              "error: --client can't be combined with --follow, "
+              "--checkpoint, --explain or --verbose\n");
+      rc = RC_ERROR;
+    } else if (params.serve_path != NULL) {
+      rc = server_run(params.serve_path, params.thread_count,
+                      HASFLAG(optmask, OPT_NUMA));
     } else if (process_argsleft(&patterns, optmask, argsleft, &file, argv,
                                 &file_path) == RC_OK) {
-      if (argc - optind == 1) {
+      // Files found under a directory are told apart by name, as if there
+      // were many arguments
+      if (argc - optind == 1 &&
+          !(HASFLAG(optmask, OPT_RECURSIVE) && is_directory(argv[optind]))) {
         ADDFLAG(optmask, OPT_NO_FILENAME);
       }
 
-      for (; optind < argc; ++optind) {
-        file_path = argv[optind];
-        file = fopen(file_path, "r");
-
-        if (file == NULL) {
-          fprintf(stderr, "error: %s: No such file or directory\n", file_path);
-          rc = RC_ERROR;
-        } else {
-          rc = search_file_for_matches(&patterns, optmask, file, file_path);
+      if (params.client_path != NULL) {
+        // Server gets plain list of files, filters are applied here
+        patterns_t file_paths = patterns_init();
+        rc = walk_paths(&params.walk, argv + optind, argc - optind,
+                        collect_path, &file_paths);
+        if (rc == RC_OK) {
+          rc = client_run(params.client_path, optmask, &patterns,
+                          file_paths.data, file_paths.count);
         }
-        fclose_if_not_null(file);
+        patterns_free(&file_paths);
+      } else {
+        rc = search_files(&patterns, optmask, &params, argc, argv);
       }
     } else {
       rc = RC_ERROR;
@@ -151,52 +272,164 @@ int main(int argc, char **argv) {
 
   // fclose_if_not_null(file);
   patterns_free(&patterns);
+  walk_free(&params.walk);
 
   return rc;
 }
 
-static char *alloc_str_from_buf(const char *buf, size_t size) {
-  char *str = calloc(size + 1, sizeof(char));
-  memory_copy(str, buf, size);
-  str[size] = '\0';
-  return str;
-}
-
-static regopt_t make_from_optmask(optmask_t optmask) {
-  regopt_t regopt = REG_NEWLINE | REG_EXTENDED;
+/*
+ * Searches files left in `argv` after options, one by one.
+ * */
+static rc_t search_files(const patterns_t *patterns, optmask_t optmask,
+                         const params_t *params, int argc, char **argv) {
+  rc_t rc = RC_OK;
+  engine_t *engine = NULL;
+  engine_set_t *set = NULL;
+  struct timespec compile_start, compile_end;
+  iomem_stats_t memory_stats;
 
-  if (HASFLAG(optmask, OPT_IGNORE_CASE)) {
-    ADDFLAG(regopt, REG_ICASE);
+  if (HASFLAG(optmask, OPT_VERBOSE)) {
+    memory_stats = iomem_stats_start();
   }
 
-  return regopt;
-}
+  clock_gettime(CLOCK_MONOTONIC, &compile_start);
+  rc_t compile_rc =
+      engine_compile(&engine, patterns, make_engine_flags(optmask));
+  clock_gettime(CLOCK_MONOTONIC, &compile_end);
 
-static rc_t alloc_regexes_and_compile(regex_t **regexes,
-                                      const patterns_t *patterns,
-                                      optmask_t optmask) {
-  rc_t rc = RC_OK;
+  if (compile_rc == RC_OK) {
+    set = engine_acquire(engine);
+  }
 
-  if (!(patterns->count > 0)) {
-    rc = RC_PATTERN_NOT_FOUND;
+  if (HASFLAG(optmask, OPT_VERBOSE) && compile_rc == RC_OK) {
+    print_patterns_stats(engine_stats(engine),
+                         (compile_end.tv_sec - compile_start.tv_sec) * 1e3 +
+                             (compile_end.tv_nsec - compile_start.tv_nsec) /
+                                 1e6);
   }
 
-  if (rc == RC_OK) {
-    *regexes = calloc(patterns->count, sizeof(regex_t));
+  if (HASFLAG(optmask, OPT_EXPLAIN) && compile_rc == RC_OK) {
+    engine_explain(engine, stderr);
   }
 
-  for (size_t i = 0; rc == RC_OK && i < patterns->count; ++i) {
-    if (regcomp((*regexes) + i, patterns->data[i],
-                make_from_optmask(optmask)) != RC_OK) {
-      rc = RC_ERROR;
+  if (compile_rc == RC_ERROR) {
+    fprintf(stderr, "error: Failed to compile patterns\n");
+    rc = RC_ERROR;
+  } else if (HASFLAG(optmask, OPT_FOLLOW) && compile_rc == RC_OK) {
+    patterns_t file_paths = patterns_init();
+    rc = walk_paths(&params->walk, argv + optind, argc - optind, collect_path,
+                    &file_paths);
+    if (rc == RC_OK) {
+      rc = follow_files_for_matches(set, optmask, params, file_paths.data,
+                                    file_paths.count);
+    }
+    patterns_free(&file_paths);
+  } else {
+    // Nothing searched (all filtered out) is the same as nothing found
+    search_t search = {
+        .engine = engine,
+        .set = set,
+        .optmask = optmask,
+        .params = params,
+        .search_loop = pick_search_loop(optmask),
+        .compile_rc = compile_rc,
+        .rc = RC_PATTERN_NOT_FOUND,
+    };
+
+    rc = walk_paths(&params->walk, argv + optind, argc - optind, search_path,
+                    &search);
+    if (rc == RC_OK) {
+      rc = search.rc;
     }
   }
 
+  if (set != NULL) {
+    engine_release(engine, set);
+  }
+  engine_free(engine);
+
+  if (HASFLAG(optmask, OPT_VERBOSE)) {
+    iomem_stats_stop(&memory_stats);
+    iomem_stats_print(&memory_stats, stderr);
+  }
+
   return rc;
 }
 
-static void print_filename_prefix_if_should(optmask_t optmask,
-                                            const char *file_path) {
+/*
+ * Same as grep(1): an error anywhere wins even over matches, then any match,
+ * and only if every file came up empty it's RC_PATTERN_NOT_FOUND.
+ * */
+static rc_t merge_search_rc(rc_t rc, rc_t file_rc) {
+  if (rc == RC_ERROR || file_rc == RC_ERROR) {
+    return RC_ERROR;
+  } else if (rc == RC_OK || file_rc == RC_OK) {
+    return RC_OK;
+  }
+  return file_rc;
+}
+
+/*
+ * Searches one file picked by `walk_paths`.
+ * */
+static void search_path(int dir_fd, const char *name, const char *file_path,
+                        void *user_data) {
+  search_t *search = user_data;
+  const params_t *params = search->params;
+  int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+  FILE *file = fd != -1 ? fdopen(fd, "r") : NULL;
+  rc_t file_rc = RC_PATTERN_NOT_FOUND;
+
+  if (file == NULL) {
+    if (!HASFLAG(search->optmask, OPT_NO_MESSAGES)) {
+      fprintf(stderr, "error: %s: No such file or directory\n", file_path);
+    }
+    if (fd != -1) {
+      close(fd);
+    }
+    file_rc = RC_ERROR;
+  } else if (search->compile_rc != RC_OK) {
+    file_rc = search->compile_rc;
+  } else if (HASFLAG(search->optmask, OPT_COUNT) &&
+             params->max_line_buffer == 0 &&
+             (file_rc = count_file_for_matches(search->engine, search->optmask,
+                                               params, file, file_path)) !=
+                 RC_ERROR) {
+    // Counted without looking at every line separately
+  } else {
+    engine_set_reset(search->set);
+    file_rc = search_file_for_matches(search->set, search->optmask, params,
+                                      search->search_loop, file, file_path);
+    if (HASFLAG(search->optmask, OPT_EXPLAIN)) {
+      engine_explain_set(search->set, stderr, file_path);
+    }
+  }
+
+  search->rc = merge_search_rc(search->rc, file_rc);
+  fclose_if_not_null(file);
+}
+
+static int make_engine_flags(optmask_t optmask) {
+  int flags = 0;
+
+  if (HASFLAG(optmask, OPT_IGNORE_CASE)) {
+    ADDFLAG(flags, ENGINE_IGNORE_CASE);
+  }
+
+  return flags;
+}
+
+static void print_patterns_stats(const patterns_stats_t *stats,
+                                 double compile_ms) {
+  fprintf(stderr,
+          "patterns: %zu given, %zu duplicates dropped, %zu merged into "
+          "alternations, %zu compiled in %.3f ms\n",
+          stats->count_before, stats->duplicates, stats->merged,
+          stats->count_after, compile_ms);
+}
+
+static FORCE_INLINE void print_filename_prefix_if_should(
+    optmask_t optmask, const char *file_path) {
   if (!HASFLAG(optmask, OPT_NO_FILENAME)) {
     if (HASFLAG(optmask, OPT_NO_COLOR)) {
       printf("%s:", file_path);
@@ -209,10 +442,10 @@ static void print_filename_prefix_if_should(optmask_t optmask,
   }
 }
 
-static void print_matches_if_should(optmask_t optmask, const char *line,
-                                    regmatch_t *matches, size_t match_count,
-                                    size_t line_number, size_t *line_matched,
-                                    const char *file_path) {
+static FORCE_INLINE void print_matches_if_should(
+    optmask_t optmask, const line_t *line, regmatch_t *matches,
+    size_t match_count, size_t line_number, size_t *line_matched,
+    const char *file_path) {
   bool hasmatches = match_count > 0;
   bool should_print_this_line =
       ((hasmatches && !HASFLAG(optmask, OPT_INVERT_MATCH)) ||
@@ -221,7 +454,12 @@ static void print_matches_if_should(optmask_t optmask, const char *line,
   bool should_print = !HASFLAG(optmask, OPT_FILES_WITH_MATCHES) &&
                       !HASFLAG(optmask, OPT_COUNT) && should_print_this_line;
 
-  if (should_print) {
+  if (should_print && HASFLAG(optmask, OPT_JSON)) {
+    print_json_matches(line, matches, match_count, line_number, file_path);
+  } else if (should_print && HASFLAG(optmask, OPT_ONLY_MATCHING)) {
+    print_only_matching(optmask, line, matches, match_count, line_number,
+                        file_path);
+  } else if (should_print) {
     print_filename_prefix_if_should(optmask, file_path);
     print_matches(optmask, line, matches, match_count, line_number);
   }
@@ -231,23 +469,36 @@ static void print_matches_if_should(optmask_t optmask, const char *line,
   }
 }
 
-static void print_line_count_if_should(optmask_t optmask, size_t line_matched,
-                                       size_t lines_total,
-                                       const char *const file_path) {
-  size_t count = HASFLAG(optmask, OPT_INVERT_MATCH) ? lines_total - line_matched
-                                                    : line_matched;
+/*
+ * :returns: Number of lines printed (or counted, or listed by) `-v` or not
+ * */
+static size_t count_selected(optmask_t optmask, const count_t *count) {
+  return HASFLAG(optmask, OPT_INVERT_MATCH)
+             ? count->lines_total - count->lines_matched
+             : count->lines_matched;
+}
 
-  if (HASFLAG(optmask, OPT_COUNT)) {
+static void print_line_count_if_should(optmask_t optmask, size_t line_selected,
+                                       const char *const file_path) {
+  if (HASFLAG(optmask, OPT_COUNT) && HASFLAG(optmask, OPT_JSON)) {
+    fputs("{\"path\":", stdout);
+    json_fput_string(stdout, file_path, strlen(file_path));
+    printf(",\"count\":%zu}\n", line_selected);
+  } else if (HASFLAG(optmask, OPT_COUNT)) {
     print_filename_prefix_if_should(optmask, file_path);
-    printf("%zu\n", count);
+    printf("%zu\n", line_selected);
   }
 }
 
 static void print_filename_with_matches_if_should(optmask_t optmask,
                                                   const char *const file_path,
-                                                  size_t line_matched) {
-  if (HASFLAG(optmask, OPT_FILES_WITH_MATCHES) && line_matched > 0) {
-    if (HASFLAG(optmask, OPT_NO_COLOR)) {
+                                                  size_t line_selected) {
+  if (HASFLAG(optmask, OPT_FILES_WITH_MATCHES) && line_selected > 0) {
+    if (HASFLAG(optmask, OPT_JSON)) {
+      fputs("{\"path\":", stdout);
+      json_fput_string(stdout, file_path, strlen(file_path));
+      fputs("}\n", stdout);
+    } else if (HASFLAG(optmask, OPT_NO_COLOR)) {
       printf("%s\n", file_path);
     } else {
       USE_FG(FILENAME_COLOR) { printf("%s\n", file_path); }
@@ -255,88 +506,433 @@ static void print_filename_with_matches_if_should(optmask_t optmask,
   }
 }
 
-static size_t search_line_for_matches(regmatch_t *matches,
-                                      const regex_t *regexes,
-                                      const patterns_t *patterns,
-                                      const char *line_buffer,
-                                      size_t line_buffer_size) {
-  size_t match_count = 0;
-  // NOTE(wittenbb): `getline` returns non-nullterminated string, but
-  // `regexec` requires one
-  char *search_str = alloc_str_from_buf(line_buffer, line_buffer_size);
-  char *search_ptr = search_str;
-
-  for (size_t pattern_idx = 0;
-       match_count < MAX_MATCHES && pattern_idx < patterns->count;
-       ++pattern_idx) {
-    int regexec_rc = RC_OK;
-    size_t search_off = 0;
-    while (match_count < MAX_MATCHES &&
-           (regexec_rc = regexec(regexes + pattern_idx, search_ptr + search_off,
-                                 MAX_MATCHES - match_count,
-                                 matches + match_count, 0)) == REG_NOERROR &&
-           regexec_rc != REG_NOMATCH) {
-      regmatch_t *match = matches + match_count;
-      match->rm_so += search_off;
-      match->rm_eo += search_off;
-      search_off = matches[match_count].rm_eo;
-      match_count++;
+static FORCE_INLINE count_t search_file_loop(engine_set_t *set,
+                                             optmask_t optmask,
+                                             const params_t *params,
+                                             FILE *file,
+                                             const char *file_path) {
+  count_t count = {.lines_total = 0, .lines_matched = 0, .rc = RC_OK};
+  reader_t reader =
+      reader_init_limited(fileno(file), 0, params->max_line_buffer);
+  line_t line;
+  bool isdone = false;
+
+  while (!isdone && reader_next_line(&reader, &line)) {
+    ++count.lines_total;
+
+    if (line.iscut) {
+      cut_line_t cut;
+      search_cut_line(set, optmask, &reader, &line, &cut);
+      if (print_cut_line_if_should(optmask, reader.fd, &cut,
+                                   count.lines_total, &count.lines_matched,
+                                   file_path) != RC_OK) {
+        count.rc = RC_ERROR;
+      }
+    } else {
+      regmatch_t matches[ENGINE_MAX_MATCHES];
+      size_t match_count = engine_match_line(set, line.data, line.size,
+                                             matches, ENGINE_MAX_MATCHES);
+      print_matches_if_should(optmask, &line, matches, match_count,
+                              count.lines_total, &count.lines_matched,
+                              file_path);
+    }
+
+    // `-l` is answered by the first selected line
+    isdone = HASFLAG(optmask, OPT_FILES_WITH_MATCHES) &&
+             !HASFLAG(optmask, OPT_COUNT) &&
+             count_selected(optmask, &count) > 0;
+  }
+
+  reader_free(&reader);
+
+  return count;
+}
+
+#define DEFINE_SEARCH_LOOP(__NAME, __OPTMASK)                           \
+  static count_t search_loop_##__NAME(                                  \
+      engine_set_t *set, optmask_t optmask, const params_t *params,     \
+      FILE *file, const char *file_path) {                              \
+    KEEP(optmask);                                                      \
+    return search_file_loop(set, (__OPTMASK), params, file, file_path); \
+  }
+
+SEARCH_LOOPS(DEFINE_SEARCH_LOOP)
+
+#undef DEFINE_SEARCH_LOOP
+
+static count_t search_loop_generic(engine_set_t *set, optmask_t optmask,
+                                   const params_t *params, FILE *file,
+                                   const char *file_path) {
+  return search_file_loop(set, optmask, params, file, file_path);
+}
+
+/*
+ * :returns: Search loop specialized for `optmask`, so the hot loop doesn't
+ *           test flags for every line and character
+ * */
+static search_loop_t pick_search_loop(optmask_t optmask) {
+#define MAKE_SEARCH_LOOP_ENTRY(__NAME, __OPTMASK) \
+  {(__OPTMASK), search_loop_##__NAME},
+
+  static const struct {
+    optmask_t optmask;
+    search_loop_t search_loop;
+  } SEARCH_LOOP_TABLE[] = {SEARCH_LOOPS(MAKE_SEARCH_LOOP_ENTRY)};
+
+#undef MAKE_SEARCH_LOOP_ENTRY
+
+  search_loop_t search_loop = search_loop_generic;
+  optmask_t key = HASFLAG(optmask, SEARCH_LOOP_QUIET_MASK)
+                      ? optmask & SEARCH_LOOP_QUIET_KEY_MASK
+                      : optmask & SEARCH_LOOP_MASK;
+
+  for (size_t i = 0; i < sizeof(SEARCH_LOOP_TABLE) / sizeof(*SEARCH_LOOP_TABLE);
+       ++i) {
+    if (SEARCH_LOOP_TABLE[i].optmask == key) {
+      search_loop = SEARCH_LOOP_TABLE[i].search_loop;
     }
   }
-  free(search_str);
-  return match_count;
+
+  return search_loop;
 }
 
-static rc_t search_file_for_matches(const patterns_t *patterns,
-                                    optmask_t optmask, FILE *file,
+static rc_t search_file_for_matches(engine_set_t *set, optmask_t optmask,
+                                    const params_t *params,
+                                    search_loop_t search_loop, FILE *file,
                                     const char *file_path) {
   rc_t rc = RC_OK;
-  regex_t *regexes = NULL;
-  char *line_buffer = NULL;
-  size_t line_buffer_size = 0, line_matched = 0, lines_count = 0;
+  count_t count = search_loop(set, optmask, params, file, file_path);
+  size_t selected = count_selected(optmask, &count);
 
-  rc = alloc_regexes_and_compile(&regexes, patterns, optmask);
+  print_filename_with_matches_if_should(optmask, file_path, selected);
+  print_line_count_if_should(optmask, selected, file_path);
 
-  while (rc == RC_OK &&
-         getline(&line_buffer, &line_buffer_size, file) != RC_END) {
-    ++lines_count;
+  if (count.rc != RC_OK) {
+    rc = count.rc;
+  } else if (selected == 0) {
+    rc = RC_PATTERN_NOT_FOUND;
+  }
+
+  return rc;
+}
+
+/*
+ * Goes through windows of line cut by the reader, `line` is the first of
+ * them. Search in every window resumes after the last match taken, like it
+ * does in a whole line, so matches crossing window boundaries are taken once.
+ * */
+static void search_cut_line(engine_set_t *set, optmask_t optmask,
+                            reader_t *reader, line_t *line, cut_line_t *cut) {
+  // Positions of matches matter only for coloring, JSON and `-o`
+  bool needsmatches = !HASFLAG(optmask, OPT_NO_COLOR) ||
+                      HASFLAG(optmask, OPT_JSON | OPT_ONLY_MATCHING);
+  unsigned long long covered = 0;
+  bool isdone = false;
+
+  cut->offset = line->offset;
+  cut->hasmatches = false;
+  cut->match_count = 0;
+
+  while (!isdone) {
+    if (!cut->hasmatches ||
+        (needsmatches && cut->match_count < ENGINE_MAX_MATCHES)) {
+      regmatch_t matches[ENGINE_MAX_MATCHES];
+      size_t from = line->owned_begin;
+
+      if (covered > line->window_offset + from) {
+        from = covered - line->window_offset;
+      }
+
+      size_t match_count =
+          engine_match_window(set, line->data, line->size, from,
+                              line->islast, matches, ENGINE_MAX_MATCHES);
+
+      for (size_t i = 0; i < match_count; ++i) {
+        if ((size_t)matches[i].rm_so >= line->owned_end) {
+          continue;  // Next window will take it whole
+        }
+
+        engine_span_t match = {
+            .so = line->window_offset + matches[i].rm_so,
+            .eo = line->window_offset + matches[i].rm_eo,
+        };
 
-    regmatch_t matches[MAX_MATCHES] = {0};
-    size_t match_count = search_line_for_matches(matches, regexes, patterns,
-                                                 line_buffer, line_buffer_size);
-    print_matches_if_should(optmask, line_buffer, matches, match_count,
-                            lines_count, &line_matched, file_path);
+        if (needsmatches && cut->match_count < ENGINE_MAX_MATCHES) {
+          cut->matches[cut->match_count++] = match;
+        }
+
+        cut->hasmatches = true;
+        covered = match.eo > covered ? match.eo : covered;
+      }
+    }
+
+    cut->size = line->window_offset + line->size;
+    cut->hasnewline = line->data[line->size - 1] == '\n';
+    isdone = line->islast || !reader_next_line(reader, line);
   }
+}
 
-  // #ifndef SILLY_MUSL_IMPL
-  // print_filename_with_matches_if_should(optmask, file_path, line_matched);
-  // print_line_count_if_should(optmask, line_matched, lines_count, file_path);
-  // #else
-  if (rc != RC_PATTERN_NOT_FOUND) {
-    print_filename_with_matches_if_should(optmask, file_path, line_matched);
-    print_line_count_if_should(optmask, line_matched, lines_count, file_path);
+/*
+ * Copies `size` bytes at `offset` of `fd` to stdout, escaped for JSON if
+ * `isjson`.
+ *
+ * :returns: false if file ended or failed before all of them
+ * */
+static bool copy_fd_range(int fd, unsigned long long offset,
+                          unsigned long long size, bool isjson) {
+  char buf[READER_BLOCK_SIZE];
+  ssize_t got = 0;
+
+  while (size > 0 &&
+         (got = pread(fd, buf, size < sizeof(buf) ? size : sizeof(buf),
+                      (off_t)offset)) > 0) {
+    if (isjson) {
+      json_fput_chars(stdout, buf, got);
+    } else {
+      fwrite(buf, sizeof(char), got, stdout);
+    }
+    offset += got;
+    size -= got;
   }
-  // #endif
 
-  for (size_t i = 0; i < patterns->count; ++i) {
-    regfree(regexes + i);
+  return size == 0;
+}
+
+/*
+ * Same as `print_matches_if_should` for a line which didn't fit in memory,
+ * it's read from `fd` again piece by piece. Lines of input which can't be
+ * read again (pipes and such) are only counted.
+ *
+ * :returns: RC_ERROR if line had to be printed and couldn't be read again
+ * */
+static rc_t print_cut_line_if_should(optmask_t optmask, int fd,
+                                     cut_line_t *cut, size_t line_number,
+                                     size_t *line_matched,
+                                     const char *file_path) {
+  bool should_print = !HASFLAG(optmask, OPT_FILES_WITH_MATCHES) &&
+                      !HASFLAG(optmask, OPT_COUNT) &&
+                      cut->hasmatches != !!HASFLAG(optmask, OPT_INVERT_MATCH);
+  bool isok = true;
+
+  if (cut->hasmatches) {
+    ++(*line_matched);
   }
-  free_if_not_null(line_buffer);
-  free_if_not_null(regexes);
 
-  if (line_matched == 0) {
-    rc = RC_PATTERN_NOT_FOUND;
+  if (should_print && lseek(fd, 0, SEEK_CUR) == -1) {
+    fprintf(stderr,
+            "error: %s: Line %zu is longer than --max-line-buffer and can't "
+            "be read again to print it\n",
+            file_path, line_number);
+    isok = false;
+  } else if (should_print && HASFLAG(optmask, OPT_JSON)) {
+    fputs("{\"path\":", stdout);
+    json_fput_string(stdout, file_path, strlen(file_path));
+    printf(",\"line\":%zu,\"offset\":%llu,\"text\":\"", line_number,
+           cut->offset);
+    isok = copy_fd_range(fd, cut->offset, cut->size - cut->hasnewline, true);
+    fputs("\",\"spans\":[", stdout);
+
+    for (size_t i = 0; i < cut->match_count; ++i) {
+      printf("%s[%llu,%llu]", i > 0 ? "," : "", cut->matches[i].so,
+             cut->matches[i].eo);
+    }
+
+    fputs("]}\n", stdout);
+  } else if (should_print && HASFLAG(optmask, OPT_ONLY_MATCHING)) {
+    size_t match_count = engine_disjoint_spans(cut->matches, cut->match_count);
+
+    for (size_t i = 0; isok && i < match_count; ++i) {
+      const engine_span_t *match = cut->matches + i;
+
+      print_filename_prefix_if_should(optmask, file_path);
+      print_line_prefix(optmask, line_number, cut->offset + match->so);
+      if (HASFLAG(optmask, OPT_NO_COLOR)) {
+        isok = copy_fd_range(fd, cut->offset + match->so,
+                             match->eo - match->so, false);
+      } else {
+        USE_FG(MATCH_COLOR) {
+          isok = copy_fd_range(fd, cut->offset + match->so,
+                               match->eo - match->so, false);
+        }
+      }
+      putchar('\n');
+    }
+  } else if (should_print) {
+    unsigned long long printed = 0;
+
+    print_filename_prefix_if_should(optmask, file_path);
+    print_line_prefix(optmask, line_number, cut->offset);
+
+    if (!HASFLAG(optmask, OPT_NO_COLOR)) {
+      engine_sort_spans(cut->matches, cut->match_count);
+    }
+
+    for (size_t i = 0;
+         isok && !HASFLAG(optmask, OPT_NO_COLOR) && i < cut->match_count;
+         ++i) {
+      unsigned long long so = cut->matches[i].so;
+      unsigned long long eo = cut->matches[i].eo;
+
+      if (so < printed) {
+        so = printed;
+      }
+
+      if (so < eo) {
+        isok = copy_fd_range(fd, cut->offset + printed, so - printed, false);
+        USE_FG(MATCH_COLOR) {
+          isok = isok && copy_fd_range(fd, cut->offset + so, eo - so, false);
+        }
+        printed = eo;
+      }
+    }
+
+    isok = isok &&
+           copy_fd_range(fd, cut->offset + printed, cut->size - printed, false);
+  }
+
+  if (!isok && lseek(fd, 0, SEEK_CUR) != -1) {
+    fprintf(stderr, "error: %s: Line %zu can't be read again to print it\n",
+            file_path, line_number);
+  }
+
+  return isok ? RC_OK : RC_ERROR;
+}
+
+/*
+ * `-c` doesn't need positions of matches nor printing decisions per line, so
+ * regular files are counted in parallel chunks instead.
+ *
+ * :returns: RC_ERROR if file can't be counted that way
+ * */
+static rc_t count_file_for_matches(engine_t *engine, optmask_t optmask,
+                                   const params_t *params, FILE *file,
+                                   const char *file_path) {
+  count_t count = {.lines_total = 0, .lines_matched = 0, .rc = RC_OK};
+  rc_t rc = count_fd_matches(&count, engine, fileno(file), params->thread_count,
+                             HASFLAG(optmask, OPT_NUMA));
+
+  if (rc == RC_OK) {
+    size_t selected = count_selected(optmask, &count);
+
+    print_filename_with_matches_if_should(optmask, file_path, selected);
+    print_line_count_if_should(optmask, selected, file_path);
+
+    if (selected == 0) {
+      rc = RC_PATTERN_NOT_FOUND;
+    }
   }
 
   return rc;
 }
 
+/*
+ * Searches only complete lines appended after `entry->offset`, trailing
+ * line without '\n' is left for the next time.
+ * */
+static void search_file_tail_for_matches(engine_set_t *set, optmask_t optmask,
+                                         int fd, follow_entry_t *entry) {
+  // NOTE: `fd` stays open between polls, `reader_init` doesn't rewind it
+  // for offset 0
+  if (lseek(fd, (off_t)entry->offset, SEEK_SET) == -1) {
+    return;
+  }
+
+  reader_t reader = reader_init(fd, entry->offset);
+  line_t line;
+  size_t line_matched = 0;
+
+  while (reader_next_line(&reader, &line) &&
+         line.data[line.size - 1] == '\n') {
+    entry->offset += line.size;
+    ++entry->line;
+
+    regmatch_t matches[ENGINE_MAX_MATCHES];
+    size_t match_count = engine_match_line(set, line.data, line.size, matches,
+                                           ENGINE_MAX_MATCHES);
+    print_matches_if_should(optmask, &line, matches, match_count, entry->line,
+                            &line_matched, entry->path);
+  }
+
+  reader_free(&reader);
+}
+
+static rc_t follow_files_for_matches(engine_set_t *set, optmask_t optmask,
+                                     const params_t *params, char **file_paths,
+                                     size_t file_count) {
+  rc_t rc = RC_OK;
+  follow_entry_t *entries = calloc(file_count, sizeof(follow_entry_t));
+
+  for (size_t i = 0; i < file_count; ++i) {
+    entries[i] = follow_entry_init(file_paths[i]);
+  }
+
+  if (params->checkpoint_path != NULL) {
+    follow_checkpoint_load(params->checkpoint_path, entries, file_count);
+  }
+
+  follow_watch_t watch = follow_watch_init(entries, file_count);
+
+  for (bool isfirst = true; rc == RC_OK; isfirst = false) {
+    bool haschanges = false;
+
+    for (size_t i = 0; i < file_count; ++i) {
+      follow_entry_t *entry = entries + i;
+      int fd = open(entry->path, O_RDONLY);
+
+      if (fd == -1 && isfirst && !HASFLAG(optmask, OPT_NO_MESSAGES)) {
+        fprintf(stderr, "error: %s: No such file or directory\n",
+                entry->path);
+      }
+
+      follow_event_t event = follow_entry_sync(entry, fd);
+
+      // Lines appended to the old file before rotation come first
+      if (event == FOLLOW_ROTATED) {
+        search_file_tail_for_matches(set, optmask, entry->fd, entry);
+        follow_entry_rotate(entry);
+      }
+
+      if (event != FOLLOW_NONE) {
+        search_file_tail_for_matches(set, optmask, entry->fd, entry);
+        haschanges = true;
+      }
+    }
+
+    if (haschanges) {
+      fflush(stdout);
+
+      if (params->checkpoint_path != NULL &&
+          !follow_checkpoint_save(params->checkpoint_path, entries,
+                                  file_count)) {
+        fprintf(stderr, "error: %s: Failed to save checkpoint\n",
+                params->checkpoint_path);
+        rc = RC_ERROR;
+      }
+    }
+
+    if (rc == RC_OK) {
+      follow_watch_wait(&watch);
+    }
+  }
+
+  follow_watch_free(&watch);
+  for (size_t i = 0; i < file_count; ++i) {
+    follow_entry_free(entries + i);
+  }
+  free(entries);
+
+  return rc;
+}
+
 static rc_t process_argsleft(patterns_t *patterns, optmask_t optmask,
                              int argsleft, FILE **file, char **argv,
                              const char **file_path) {
   rc_t rc = RC_OK;
-  if (argsleft > 0) {
-    if (argsleft > 1 && !HASFLAG(optmask, OPT_REGEXP) &&
+  // -r searches "." when there are no files
+  bool isrecursive = HASFLAG(optmask, OPT_RECURSIVE);
+  if (argsleft > 0 ||
+      (isrecursive && HASFLAG(optmask, OPT_REGEXP | OPT_FILE))) {
+    if ((argsleft > 1 || isrecursive) && !HASFLAG(optmask, OPT_REGEXP) &&
         !HASFLAG(optmask, OPT_FILE)) {
       patterns_push(patterns, argv[optind++]);
     }
@@ -351,9 +947,9 @@ static rc_t process_argsleft(patterns_t *patterns, optmask_t optmask,
 }
 
 static rc_t gather_optmask_and_patterns(optmask_t *optmask,
-                                        patterns_t *patterns, int argc,
-                                        char **argv, int *argsleft) {
-  static const char *SHORT_OPTS = "e:f:icvlosnh";
+                                        patterns_t *patterns, params_t *params,
+                                        int argc, char **argv, int *argsleft) {
+  static const char *SHORT_OPTS = "e:f:icvlosnhbr";
   static const struct option LONG_OPTS[] = {
       MAKE_FLAG_OPT("regexp", OPT_REGEXP),
       MAKE_FLAG_OPT("file", OPT_FILE),
@@ -366,6 +962,25 @@ static rc_t gather_optmask_and_patterns(optmask_t *optmask,
       MAKE_FLAG_OPT("line-number", OPT_LINE_NUMBER),
       MAKE_FLAG_OPT("no-filename", OPT_NO_FILENAME),
       MAKE_FLAG_OPT("help", OPT_HELP),
+      MAKE_FLAG_OPT("byte-offset", OPT_BYTE_OFFSET),
+      MAKE_FLAG_OPT("json", OPT_JSON),
+      MAKE_FLAG_OPT("verbose", OPT_VERBOSE),
+      MAKE_FLAG_OPT("explain", OPT_EXPLAIN),
+      MAKE_FLAG_OPT("numa", OPT_NUMA),
+      MAKE_FLAG_OPT("utf8", OPT_UTF8),
+      MAKE_FLAG_OPT("follow", OPT_FOLLOW),
+      MAKE_FLAG_OPT("recursive", OPT_RECURSIVE),
+      MAKE_PARAM_OPT("checkpoint", PARAM_CHECKPOINT),
+      MAKE_PARAM_OPT("threads", PARAM_THREADS),
+      MAKE_PARAM_OPT("serve", PARAM_SERVE),
+      MAKE_PARAM_OPT("client", PARAM_CLIENT),
+      MAKE_PARAM_OPT("max-line-buffer", PARAM_MAX_LINE_BUFFER),
+      MAKE_PARAM_OPT("include", PARAM_INCLUDE),
+      MAKE_PARAM_OPT("exclude", PARAM_EXCLUDE),
+      MAKE_PARAM_OPT("exclude-dir", PARAM_EXCLUDE_DIR),
+      MAKE_PARAM_OPT("max-filesize", PARAM_MAX_FILESIZE),
+      MAKE_PARAM_OPT("ignore-file", PARAM_IGNORE_FILE),
+      {0},
   };
 
   rc_t rc = RC_OK;
@@ -414,24 +1029,163 @@ static rc_t gather_optmask_and_patterns(optmask_t *optmask,
         ADDFLAG(*optmask, OPT_FILES_WITH_MATCHES);
         break;
 
+      case 'o':
+      case OPT_ONLY_MATCHING:
+        ADDFLAG(*optmask, OPT_ONLY_MATCHING);
+        break;
+
+      case 's':
+      case OPT_NO_MESSAGES:
+        ADDFLAG(*optmask, OPT_NO_MESSAGES);
+        break;
+
       case 'n':
       case OPT_LINE_NUMBER:
         ADDFLAG(*optmask, OPT_LINE_NUMBER);
         break;
+
+      case 'b':
+      case OPT_BYTE_OFFSET:
+        ADDFLAG(*optmask, OPT_BYTE_OFFSET);
+        break;
+
+      case OPT_JSON:
+        ADDFLAG(*optmask, OPT_JSON | OPT_NO_COLOR);
+        break;
+
+      case OPT_VERBOSE:
+        ADDFLAG(*optmask, OPT_VERBOSE);
+        break;
+
+      case OPT_EXPLAIN:
+        ADDFLAG(*optmask, OPT_EXPLAIN);
+        break;
+
+      case OPT_NUMA:
+        ADDFLAG(*optmask, OPT_NUMA);
+        break;
+
+      case OPT_UTF8:
+        ADDFLAG(*optmask, OPT_UTF8);
+        break;
+
+      case OPT_FOLLOW:
+        ADDFLAG(*optmask, OPT_FOLLOW);
+        break;
+
+      case 'r':
+      case OPT_RECURSIVE:
+        ADDFLAG(*optmask, OPT_RECURSIVE);
+        break;
+
+      case PARAM_CHECKPOINT:
+        params->checkpoint_path = optarg;
+        break;
+
+      case PARAM_SERVE:
+        params->serve_path = optarg;
+        break;
+
+      case PARAM_CLIENT:
+        params->client_path = optarg;
+        break;
+
+      case PARAM_MAX_LINE_BUFFER:
+        if (!parse_size(optarg, &params->max_line_buffer) ||
+            params->max_line_buffer < READER_MIN_LIMIT ||
+            params->max_line_buffer > INT_MAX) {
+          fprintf(stderr, "error: %s: Invalid line buffer size\n", optarg);
+          rc = RC_ERROR;
+        }
+        break;
+
+      case PARAM_INCLUDE:
+        globset_push(&params->walk.include, optarg);
+        break;
+
+      case PARAM_EXCLUDE:
+        globset_push(&params->walk.exclude, optarg);
+        break;
+
+      case PARAM_EXCLUDE_DIR:
+        globset_push(&params->walk.exclude_dir, optarg);
+        break;
+
+      case PARAM_MAX_FILESIZE:
+        if (!parse_size(optarg, &params->walk.max_filesize) ||
+            params->walk.max_filesize == 0) {
+          fprintf(stderr, "error: %s: Invalid file size\n", optarg);
+          rc = RC_ERROR;
+        }
+        break;
+
+      case PARAM_IGNORE_FILE:
+        if (walk_push_ignore_file(&params->walk, optarg) ==
+            RC_FILE_NOT_FOUND) {
+          fprintf(stderr, "error: %s: No such file or directory\n", optarg);
+          rc = RC_ERROR;
+        }
+        break;
+
+      case PARAM_THREADS: {
+        char *optarg_end = NULL;
+        params->thread_count = strtoul(optarg, &optarg_end, 10);
+        if (*optarg == '\0' || *optarg_end != '\0') {
+          fprintf(stderr, "error: %s: Invalid number of threads\n", optarg);
+          rc = RC_ERROR;
+        }
+      } break;
     }
   }
 
+  if (rc == RC_OK && walk_compile(&params->walk) != RC_OK) {
+    fprintf(stderr, "error: Failed to compile globs\n");
+    rc = RC_ERROR;
+  }
+
   *argsleft = argc - optind;
 
   return rc;
 }
 
-static void print_matches(optmask_t optmask, const char *line,
-                          regmatch_t *matches, size_t match_count,
-                          size_t line_number) {
-  const char *line_ptr = line;
-  size_t line_idx = 0;
+/*
+ * Parses size with optional K, M or G suffix (powers of 1024).
+ * */
+static bool parse_size(const char *s, size_t *size) {
+  char *end = NULL;
+  unsigned long long value = strtoull(s, &end, 10);
+  unsigned shift = 0;
+
+  if (*end == 'K') {
+    shift = 10;
+  } else if (*end == 'M') {
+    shift = 20;
+  } else if (*end == 'G') {
+    shift = 30;
+  }
+
+  if (shift > 0) {
+    ++end;
+  }
+
+  bool isok = *s >= '0' && *s <= '9' && *end == '\0' &&
+              value <= (SIZE_MAX >> shift);
+  if (isok) {
+    *size = (size_t)(value << shift);
+  }
+
+  return isok;
+}
+
+static int compare_matches(const void *a, const void *b) {
+  regoff_t a_so = ((const regmatch_t *)a)->rm_so;
+  regoff_t b_so = ((const regmatch_t *)b)->rm_so;
+  return (a_so > b_so) - (a_so < b_so);
+}
 
+static FORCE_INLINE void print_line_prefix(optmask_t optmask,
+                                           size_t line_number,
+                                           unsigned long long offset) {
   if (HASFLAG(optmask, OPT_LINE_NUMBER)) {
     // TODO: Replace with new SSTD_COLOR API
     if (HASFLAG(optmask, OPT_NO_COLOR)) {
@@ -444,33 +1198,127 @@ static void print_matches(optmask_t optmask, const char *line,
     }
   }
 
-  while (*line_ptr != '\0') {
-    bool isinmatch = false;
+  if (HASFLAG(optmask, OPT_BYTE_OFFSET)) {
+    if (HASFLAG(optmask, OPT_NO_COLOR)) {
+      printf("%llu:", offset);
+    } else {
+      USE_FG(LINENUM_COLOR) { printf("%llu", offset); }
+      {
+        USE_FG(LINESEP_COLOR) { putchar(':'); }
+      }
+    }
+  }
+}
+
+static FORCE_INLINE void print_matches(optmask_t optmask, const line_t *line,
+                                       regmatch_t *matches, size_t match_count,
+                                       size_t line_number) {
+  print_line_prefix(optmask, line_number, line->offset);
+
+  if (HASFLAG(optmask, OPT_NO_COLOR) || match_count == 0) {
+    fputs(line->data, stdout);
+  } else {
+    // NOTE(wittenbb): Matches of different patterns come unordered and may
+    // overlap, so sort them and color their union span by span
+    size_t line_idx = 0;
+    qsort(matches, match_count, sizeof(regmatch_t), compare_matches);
+
     for (size_t match_idx = 0; match_idx < match_count; ++match_idx) {
-      const regmatch_t *match = matches + match_idx;
-      ssize_t match_off = match->rm_so;
-      ssize_t match_end = match->rm_eo;
+      size_t match_off = matches[match_idx].rm_so;
+      size_t match_end = matches[match_idx].rm_eo;
 
-      if (ISINRANGE((size_t)match_off, line_idx, (size_t)match_end)) {
-        isinmatch = true;
+      // Patterns match bytes, a span may start or end inside a character
+      if (HASFLAG(optmask, OPT_UTF8)) {
+        match_off = utf8_char_start(line->data, line->size, match_off);
+        match_end = utf8_char_end(line->data, line->size, match_end);
       }
-    }
 
-    if (isinmatch) {
-      if (HASFLAG(optmask, OPT_NO_COLOR)) {
-        putchar(*line_ptr);
-      } else {
-        USE_FG(MATCH_COLOR) { putchar(*line_ptr); }
+      if (match_off < line_idx) {
+        match_off = line_idx;
       }
+
+      if (match_off < match_end) {
+        fwrite(line->data + line_idx, sizeof(char), match_off - line_idx,
+               stdout);
+        USE_FG(MATCH_COLOR) {
+          fwrite(line->data + match_off, sizeof(char), match_end - match_off,
+                 stdout);
+        }
+        line_idx = match_end;
+      }
+    }
+
+    fputs(line->data + line_idx, stdout);
+  }
+}
+
+/*
+ * `-o`: every match on its own line, written straight from `line`. `-b`
+ * prefix is offset of the match itself.
+ * */
+static FORCE_INLINE void print_only_matching(optmask_t optmask,
+                                             const line_t *line,
+                                             regmatch_t *matches,
+                                             size_t match_count,
+                                             size_t line_number,
+                                             const char *file_path) {
+  if (HASFLAG(optmask, OPT_UTF8)) {
+    for (size_t i = 0; i < match_count; ++i) {
+      matches[i].rm_so = utf8_char_start(line->data, line->size,
+                                         matches[i].rm_so);
+      matches[i].rm_eo = utf8_char_end(line->data, line->size,
+                                       matches[i].rm_eo);
+    }
+  }
+
+  match_count = engine_disjoint_matches(matches, match_count);
+
+  for (size_t i = 0; i < match_count; ++i) {
+    const char *match = line->data + matches[i].rm_so;
+    size_t match_size = matches[i].rm_eo - matches[i].rm_so;
+
+    print_filename_prefix_if_should(optmask, file_path);
+    print_line_prefix(optmask, line_number, line->offset + matches[i].rm_so);
+
+    if (HASFLAG(optmask, OPT_NO_COLOR)) {
+      fwrite(match, sizeof(char), match_size, stdout);
     } else {
-      putchar(*line_ptr);
+      USE_FG(MATCH_COLOR) { fwrite(match, sizeof(char), match_size, stdout); }
     }
 
-    ++line_ptr;
-    ++line_idx;
+    putchar('\n');
   }
 }
 
+/*
+ * One JSON object per line, spans are byte offsets relative to the line:
+ *
+ *     {"path":"a.log","line":3,"offset":120,"text":"...","spans":[[4,9]]}
+ * */
+static void print_json_matches(const line_t *line, const regmatch_t *matches,
+                               size_t match_count, size_t line_number,
+                               const char *file_path) {
+  size_t text_size = line->size;
+  if (text_size > 0 && line->data[text_size - 1] == '\n') {
+    --text_size;
+  }
+
+  fputs("{\"path\":", stdout);
+  json_fput_string(stdout, file_path, strlen(file_path));
+  printf(",\"line\":%zu,\"offset\":%llu,\"text\":", line_number,
+         line->offset);
+  json_fput_string(stdout, line->data, text_size);
+  fputs(",\"spans\":[", stdout);
+
+  for (size_t match_idx = 0; match_idx < match_count; ++match_idx) {
+    printf("%s[%lld,%lld]", match_idx > 0 ? "," : "",
+           (long long)matches[match_idx].rm_so,
+           (long long)matches[match_idx].rm_eo);
+  }
+
+  fputs("]}\n", stdout);
+}
+
 static void print_short_usage(void) {
   printf(
       "USAGE\n"
@@ -502,16 +1350,66 @@ static void print_help(void) {
       "    -l --files-with-matches (suppress normal output; print the name of "
       "each input file with maching patterns)\n"
       "    -o --only-matching      (print only the matched [aka non-empty] "
-      "parts of matching line, with each such part on a separte output line) "
-      "[NOIMPL]\n"
+      "parts of matching line, with each such part on a separte output line)\n"
       "    -s --no-messages        (suppress error messages about nonexistent "
-      "or unreadable files) [NOIMPL]\n"
+      "or unreadable files)\n"
       "\n"
       "    Output Prefix control\n"
       "    -n --line-number  (prefix each line of output with the 1-based line "
       "number within its input file)\n"
       "    -h, --no-filename (suppress the prefixing of file names on output; "
       "this is the default when there is only one file to search) [PARTIMPL]\n"
+      "    -b --byte-offset  (prefix each line of output with the 0-based byte "
+      "offset within its input file)\n"
+      "    --json            (print one JSON object per line with path, line, "
+      "byte offset, text and match spans)\n"
+      "    --utf8            (widen colored matches to whole UTF-8 "
+      "characters, so escapes never split one)\n"
+      "\n"
+      "    File Selection\n"
+      "    -r --recursive      (search files under directories, \".\" if "
+      "there are none; symbolic links and special files met on the way are "
+      "skipped)\n"
+      "    --include GLOB      (search only files whose base name matches "
+      "GLOB)\n"
+      "    --exclude GLOB      (skip files whose base name matches GLOB)\n"
+      "    --exclude-dir GLOB  (skip directories whose base name matches "
+      "GLOB)\n"
+      "    --max-filesize SIZE (skip files bigger than SIZE [K, M, G "
+      "suffixes])\n"
+      "    --ignore-file FILE  (skip paths matching .gitignore-style rules "
+      "from FILE, relative to each searched directory)\n"
+      "\n"
+      "    Performance\n"
+      "    --threads N (split counting of -c over N threads, default is one "
+      "per CPU)\n"
+      "    --verbose   (report pattern counts before and after deduplication "
+      "and merging, compile time, and page faults and TLB misses of the "
+      "search to stderr)\n"
+      "    --explain   (print how every pattern is going to be searched and "
+      "its estimated cost to stderr, and strategies switched after sampling "
+      "a file)\n"
+      "    --numa      (spread -c and --serve threads over NUMA nodes, pinning "
+      "each one to CPUs of its node)\n"
+      "    --max-line-buffer SIZE (hold at most SIZE bytes [K, M, G suffixes] "
+      "of a line in memory, longer lines are searched in overlapping windows "
+      "and read again to be printed; matches longer than a quarter of SIZE "
+      "may be cut, or missed if no shorter one fits in a window)\n"
+      "\n"
+      "    Server Mode\n"
+      "    --serve SOCKET  (answer queries on Unix socket SOCKET, keeping "
+      "compiled patterns and read files cached between them; --threads N "
+      "sets number of workers; only the owner may connect, files are read "
+      "with the server's permissions)\n"
+      "    --client SOCKET (send this query to server on SOCKET instead of "
+      "searching here, output and exit code are the same; can't be combined "
+      "with --follow, --checkpoint, --explain or --verbose)\n"
+      "\n"
+      "    Follow Mode\n"
+      "    --follow          (keep waiting for lines appended to FILEs and "
+      "search only them, survives truncation and rotation)\n"
+      "    --checkpoint FILE (resume from offsets saved in FILE and keep it "
+      "updated while following)\n"
       "\n");
 }
 
@@ -520,3 +1418,15 @@ static void fclose_if_not_null(FILE *file) {
     fclose(file);
   }
 }
+
+static bool is_directory(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void collect_path(int dir_fd, const char *name, const char *path,
+                         void *user_data) {
+  KEEP(dir_fd);
+  KEEP(name);
+  patterns_push(user_data, path);
+}
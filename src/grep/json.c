@@ -0,0 +1,43 @@
+#define _GNU_SOURCE
+#include "json.h"
+
+/*
+ * Writes `size` bytes of `s` as JSON string literal, quotes included.
+ *
+ * NOTE(wittenbb): Bytes >= 0x80 are passed as is, input is expected to be
+ * UTF-8 already
+ * */
+void json_fput_string(FILE *out, const char *s, size_t size) {
+  putc_unlocked('"', out);
+  json_fput_chars(out, s, size);
+  putc_unlocked('"', out);
+}
+
+/*
+ * Writes `size` bytes of `s` escaped for JSON string literal, without quotes,
+ * so long strings can be written piece by piece.
+ * */
+void json_fput_chars(FILE *out, const char *s, size_t size) {
+  static const char HEX[] = "0123456789abcdef";
+
+  for (size_t i = 0; i < size; ++i) {
+    unsigned char c = s[i];
+
+    if (c == '"' || c == '\\') {
+      putc_unlocked('\\', out);
+      putc_unlocked(c, out);
+    } else if (c == '\n') {
+      putc_unlocked('\\', out);
+      putc_unlocked('n', out);
+    } else if (c == '\t') {
+      putc_unlocked('\\', out);
+      putc_unlocked('t', out);
+    } else if (c < ' ' || c == 0x7F) {
+      fputs("\\u00", out);
+      putc_unlocked(HEX[c >> 4], out);
+      putc_unlocked(HEX[c & 0xF], out);
+    } else {
+      putc_unlocked(c, out);
+    }
+  }
+}
@@ -0,0 +1,10 @@
+#ifndef GREP_JSON_H_
+#define GREP_JSON_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+void json_fput_string(FILE *out, const char *s, size_t size);
+void json_fput_chars(FILE *out, const char *s, size_t size);
+
+#endif  // GREP_JSON_H_
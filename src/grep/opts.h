@@ -0,0 +1,66 @@
+#ifndef GREP_OPTS_H_
+#define GREP_OPTS_H_
+
+#include <stddef.h>
+
+#include "sstd/bits.h"
+#include "sstd/color.h"
+#include "walk.h"
+
+#define OPT_NONE EXPAND(0)
+#define OPT_HELP MKFLAG(1)
+#define OPT_REGEXP MKFLAG(2)
+#define OPT_FILE MKFLAG(3)
+#define OPT_IGNORE_CASE MKFLAG(4)
+#define OPT_INVERT_MATCH MKFLAG(5)
+#define OPT_COUNT MKFLAG(6)
+#define OPT_FILES_WITH_MATCHES MKFLAG(7)
+#define OPT_ONLY_MATCHING MKFLAG(8)
+#define OPT_NO_MESSAGES MKFLAG(9)
+#define OPT_LINE_NUMBER MKFLAG(10)
+#define OPT_NO_FILENAME MKFLAG(11)
+#define OPT_NO_COLOR MKFLAG(12)
+#define OPT_FOLLOW MKFLAG(13)
+#define OPT_BYTE_OFFSET MKFLAG(14)
+#define OPT_JSON MKFLAG(15)
+#define OPT_VERBOSE MKFLAG(16)
+#define OPT_UTF8 MKFLAG(17)
+#define OPT_RECURSIVE MKFLAG(18)
+#define OPT_EXPLAIN MKFLAG(19)
+#define OPT_NUMA MKFLAG(20)
+
+// Long options which only carry an argument. Never a power of two, so they
+// don't clash with `OPT_*` values returned by `getopt_long`
+#define PARAM_BASE EXPAND(MKFLAG(30) + 1)
+#define PARAM_CHECKPOINT EXPAND(PARAM_BASE + 0)
+#define PARAM_THREADS EXPAND(PARAM_BASE + 1)
+#define PARAM_SERVE EXPAND(PARAM_BASE + 2)
+#define PARAM_CLIENT EXPAND(PARAM_BASE + 3)
+#define PARAM_MAX_LINE_BUFFER EXPAND(PARAM_BASE + 4)
+#define PARAM_INCLUDE EXPAND(PARAM_BASE + 5)
+#define PARAM_EXCLUDE EXPAND(PARAM_BASE + 6)
+#define PARAM_EXCLUDE_DIR EXPAND(PARAM_BASE + 7)
+#define PARAM_MAX_FILESIZE EXPAND(PARAM_BASE + 8)
+#define PARAM_IGNORE_FILE EXPAND(PARAM_BASE + 9)
+
+// Colors of output, both searching here and answering `--client`
+#define MATCH_COLOR ANSI_BOLD_RED
+#define FILENAME_COLOR ANSI_BOLD_PURPLE
+#define LINENUM_COLOR ANSI_GREEN
+#define LINESEP_COLOR ANSI_CYAN
+
+typedef unsigned int optmask_t;
+
+/*
+ * Values of options which are more than just a flag in `optmask_t`
+ * */
+typedef struct {
+  const char *checkpoint_path;
+  size_t thread_count;
+  const char *serve_path;
+  const char *client_path;
+  size_t max_line_buffer;  // 0 means lines are always read whole
+  walk_t walk;             // Which files are searched
+} params_t;
+
+#endif  // GREP_OPTS_H_
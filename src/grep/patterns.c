@@ -2,16 +2,10 @@
 
 #define _GNU_SOURCE
 #include <regex.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 
-#ifndef SSTD_STR_IMPL
-#define SSTD_STR_IMPL
-#endif  // SSTD_STR_IMPL
-
-#include "sstd/memory.h"
-#include "sstd/str.h"
-
 patterns_t patterns_init(void) {
   return (patterns_t){
       .data = NULL,
@@ -32,8 +26,7 @@ void patterns_push(patterns_t *patterns, const char *pattern) {
 
   size_t pattern_len = strlen(pattern);
   patterns->data[patterns->count] = malloc(pattern_len + 1);
-  str_copy(patterns->data[patterns->count], pattern);
-  patterns->data[patterns->count][pattern_len] = '\0';
+  memcpy(patterns->data[patterns->count], pattern, pattern_len + 1);
 
   patterns->count++;
 }
@@ -42,7 +35,7 @@ void patterns_free(patterns_t *patterns) {
   for (size_t i = 0; i < patterns->count; ++i) {
     free(patterns->data[i]);
   }
-  free_if_not_null(patterns->data);
+  free(patterns->data);
 }
 
 rc_t patterns_push_file(patterns_t *patterns, const char *file_path) {
@@ -57,13 +50,171 @@ rc_t patterns_push_file(patterns_t *patterns, const char *file_path) {
     size_t line_size = 0;
 
     while (getline(&line, &line_size, file) != RC_END) {
-      str_replace_char(line, '\n', '\0');
+      line[strcspn(line, "\n")] = '\0';
       patterns_push(patterns, line);
     }
 
-    free_if_not_null(line);
+    free(line);
     fclose(file);
   }
 
   return rc;
 }
+
+typedef struct {
+  const char *pattern;
+  size_t index;
+} pattern_ref_t;
+
+static int compare_pattern_refs(const void *lhs, const void *rhs) {
+  const pattern_ref_t *a = lhs;
+  const pattern_ref_t *b = rhs;
+  int cmp = strcmp(a->pattern, b->pattern);
+
+  // Equal patterns are ordered by position, so the first one is kept
+  if (cmp == 0) {
+    cmp = (a->index > b->index) - (a->index < b->index);
+  }
+
+  return cmp;
+}
+
+/*
+ * :returns: Index right after the bracket expression started at `pattern[i]`
+ * */
+size_t patterns_skip_bracket(const char *pattern, size_t i) {
+  ++i;
+
+  if (pattern[i] == '^') {
+    ++i;
+  }
+  if (pattern[i] == ']') {
+    ++i;
+  }
+
+  while (pattern[i] != '\0' && pattern[i] != ']') {
+    if (pattern[i] == '[' &&
+        (pattern[i + 1] == ':' || pattern[i + 1] == '=' ||
+         pattern[i + 1] == '.')) {
+      char delim = pattern[i + 1];
+      i += 2;
+      while (pattern[i] != '\0' &&
+             !(pattern[i] == delim && pattern[i + 1] == ']')) {
+        ++i;
+      }
+      i += pattern[i] != '\0' ? 2 : 0;
+    } else {
+      ++i;
+    }
+  }
+
+  return pattern[i] == ']' ? i + 1 : i;
+}
+
+/*
+ * Pattern can be joined with others by top level '|' only if it stays
+ * the same ERE inside the alternation: no backreferences (groups would be
+ * renumbered), balanced groups and nothing which repeats the preceding '|'.
+ * */
+static bool is_mergeable(const char *pattern) {
+  bool ismergeable = pattern[0] != '\0' && strchr("*+?{", pattern[0]) == NULL;
+  long depth = 0;
+
+  for (size_t i = 0; ismergeable && pattern[i] != '\0';) {
+    if (pattern[i] == '\\') {
+      ismergeable = pattern[i + 1] != '\0' &&
+                    !(pattern[i + 1] >= '0' && pattern[i + 1] <= '9');
+      i += 2;
+    } else if (pattern[i] == '[') {
+      i = patterns_skip_bracket(pattern, i);
+    } else {
+      depth += (pattern[i] == '(') - (pattern[i] == ')');
+      ismergeable = depth >= 0;
+      ++i;
+    }
+  }
+
+  return ismergeable && depth == 0;
+}
+
+/*
+ * Drops duplicates and joins mergeable patterns into `p1|p2|...`, so every
+ * line is scanned by one automaton instead of one per pattern. Matched lines
+ * stay the same.
+ *
+ * NOTE(wittenbb): Empty pattern is kept (as its own entry) rather than
+ * dropped, it matches every line and dropping it would change the output.
+ * */
+patterns_stats_t patterns_optimize(patterns_t *patterns) {
+  patterns_stats_t stats = {
+      .count_before = patterns->count,
+      .duplicates = 0,
+      .merged = 0,
+      .count_after = patterns->count,
+  };
+
+  if (patterns->count < 2) {
+    return stats;
+  }
+
+  pattern_ref_t *refs = malloc(patterns->count * sizeof(pattern_ref_t));
+  for (size_t i = 0; i < patterns->count; ++i) {
+    refs[i] = (pattern_ref_t){.pattern = patterns->data[i], .index = i};
+  }
+  qsort(refs, patterns->count, sizeof(pattern_ref_t), compare_pattern_refs);
+
+  bool *isduplicate = calloc(patterns->count, sizeof(bool));
+  for (size_t i = 1; i < patterns->count; ++i) {
+    if (strcmp(refs[i - 1].pattern, refs[i].pattern) == 0) {
+      isduplicate[refs[i].index] = true;
+    }
+  }
+  free(refs);
+
+  patterns_t optimized = patterns_init();
+  char *group = NULL;
+  size_t group_size = 0, group_count = 0;
+
+  for (size_t i = 0; i <= patterns->count; ++i) {
+    const char *pattern = i < patterns->count ? patterns->data[i] : NULL;
+    size_t pattern_size = pattern != NULL ? strlen(pattern) : 0;
+    bool isfull = pattern == NULL ||
+                  group_size + pattern_size + 1 > PATTERNS_MERGE_MAX_SIZE;
+
+    if (pattern != NULL && isduplicate[i]) {
+      ++stats.duplicates;
+      continue;
+    }
+
+    if (group_count > 0 && isfull) {
+      patterns_push(&optimized, group);
+      stats.merged += group_count - 1;
+      group_size = 0;
+      group_count = 0;
+    }
+
+    if (pattern == NULL) {
+      // Done
+    } else if (!is_mergeable(pattern)) {
+      patterns_push(&optimized, pattern);
+    } else {
+      group = realloc(group, group_size + pattern_size + 2);
+      if (group_count > 0) {
+        group[group_size++] = '|';
+      }
+      memcpy(group + group_size, pattern, pattern_size);
+      group_size += pattern_size;
+      group[group_size] = '\0';
+      ++group_count;
+    }
+  }
+
+  free(group);
+  free(isduplicate);
+  patterns_free(patterns);
+
+  *patterns = optimized;
+  stats.count_after = patterns->count;
+
+  return stats;
+}
@@ -5,15 +5,30 @@
 
 #include "rc.h"
 
+// Merged alternations aren't made longer than that, so huge `-f` files end
+// up in several moderately sized automatons instead of one giant
+#define PATTERNS_MERGE_MAX_SIZE (1 << 14)
+
 typedef struct {
   char **data;
   size_t count;
   size_t capacity;
 } patterns_t;
 
-patterns_t patterns_init(void);
-void patterns_push(patterns_t *patterns, const char *pattern);
-void patterns_free(patterns_t *patterns);
-rc_t patterns_push_file(patterns_t *patterns, const char *file_path);
+typedef struct {
+  size_t count_before;
+  size_t duplicates;
+  size_t merged;
+  size_t count_after;
+} patterns_stats_t;
+
+GREP_API patterns_t patterns_init(void);
+GREP_API void patterns_push(patterns_t *patterns, const char *pattern);
+GREP_API void patterns_free(patterns_t *patterns);
+GREP_API rc_t patterns_push_file(patterns_t *patterns, const char *file_path);
+GREP_API patterns_stats_t patterns_optimize(patterns_t *patterns);
+
+// Used by the planner too, not exported from libs21grep
+size_t patterns_skip_bracket(const char *pattern, size_t i);
 
 #endif  // GREP_PATTERNS_H_
@@ -0,0 +1,375 @@
+#include "plan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Chars which mean something in ERE, escaped they are plain chars
+#define PLAN_ERE_SPECIAL ".[]()*+?{}|^$\\"
+
+/*
+ * :returns: Index right after interval `{n,m}` started at `pattern[i]`, or
+ *           `i` if it's just a '{'
+ * */
+static size_t skip_interval(const char *pattern, size_t i) {
+  size_t end = i + 1;
+
+  while (pattern[end] == ',' || (pattern[end] >= '0' && pattern[end] <= '9')) {
+    ++end;
+  }
+
+  return pattern[end] == '}' && end > i + 1 ? end + 1 : i;
+}
+
+static void keep_longest_run(const char *run, size_t run_size, char *best,
+                             size_t *best_size) {
+  if (run_size > *best_size) {
+    memcpy(best, run, run_size);
+    *best_size = run_size;
+  }
+}
+
+/*
+ * Finds the longest run of plain chars every top level alternative of
+ * `pattern` requires. Anything which isn't a plain char (groups, brackets,
+ * classes, anchors) ends the run, repeat operators take away the char they
+ * apply to.
+ *
+ * :returns: false if some alternative requires no literal at all
+ * */
+static bool collect_literals(const char *pattern, const unsigned char *fold,
+                             patterns_t *literals) {
+  size_t size = strlen(pattern);
+  char *run = malloc(size + 1), *best = malloc(size + 1);
+  size_t run_size = 0, best_size = 0;
+  long depth = 0;
+  bool isok = true;
+
+  for (size_t i = 0; isok && i <= size;) {
+    char c = pattern[i];
+    bool isliteral = false;
+
+    if (i == size || (c == '|' && depth == 0)) {
+      keep_longest_run(run, run_size, best, &best_size);
+      best[best_size] = '\0';
+      isok = best_size > 0;
+      if (isok) {
+        patterns_push(literals, best);
+      }
+      run_size = best_size = 0;
+      ++i;
+    } else if (c == '\\') {
+      char next = pattern[i + 1];
+      isliteral = next != '\0' && strchr(PLAN_ERE_SPECIAL, next) != NULL;
+      c = next;
+      i += next != '\0' ? 2 : 1;
+    } else if (c == '[') {
+      i = patterns_skip_bracket(pattern, i);
+    } else if (depth > 0 || c == '(' || c == ')') {
+      // Unbalanced ')' is a plain char for glibc, but not for us
+      depth += (c == '(') - (c == ')' && depth > 0);
+      ++i;
+    } else if (c == '*' || c == '+' || c == '?' ||
+               (c == '{' && skip_interval(pattern, i) != i)) {
+      run_size -= run_size > 0 ? 1 : 0;
+      i = c == '{' ? skip_interval(pattern, i) : i + 1;
+    } else {
+      isliteral = strchr(".^${\n", c) == NULL;
+      ++i;
+    }
+
+    if (depth > 0 || i > size) {
+      // Inside of group isn't required as a whole
+    } else if (isliteral) {
+      run[run_size++] = fold[(unsigned char)c];
+    } else if (c != '|') {
+      keep_longest_run(run, run_size, best, &best_size);
+      run_size = 0;
+    }
+  }
+
+  free(run);
+  free(best);
+
+  return isok;
+}
+
+/*
+ * Reads plain char at `pattern[*i]`, escaped specials included.
+ *
+ * :returns: false if it's anything but a plain char
+ * */
+static bool read_plain_char(const char *pattern, size_t *i, char *c) {
+  bool isplain = false;
+
+  if (pattern[*i] == '\\') {
+    isplain = pattern[*i + 1] != '\0' &&
+              strchr(PLAN_ERE_SPECIAL, pattern[*i + 1]) != NULL;
+    *c = pattern[*i + 1];
+    *i += isplain ? 2 : 0;
+  } else {
+    isplain = pattern[*i] != '\0' && pattern[*i] != '\n' &&
+              strchr(PLAN_ERE_SPECIAL, pattern[*i]) == NULL;
+    *c = pattern[*i];
+    *i += isplain ? 1 : 0;
+  }
+
+  return isplain;
+}
+
+/*
+ * Splits `pattern` into top level alternatives if every one of them is a
+ * non-empty plain string, optionally tied to line start by '^' and to line
+ * end by '$'.
+ *
+ * :returns: false if some alternative is anything else
+ * */
+static bool collect_alternatives(const char *pattern, const unsigned char *fold,
+                                 plan_t *plan) {
+  size_t size = strlen(pattern);
+  char *run = malloc(size + 1);
+  bool isok = true;
+  size_t i = 0;
+
+  do {
+    size_t run_size = 0;
+    int anchors = 0;
+    char c = 0;
+
+    if (pattern[i] == '^') {
+      ADDFLAG(anchors, PLAN_ANCHOR_BEGIN);
+      ++i;
+    }
+
+    while (read_plain_char(pattern, &i, &c)) {
+      run[run_size++] = fold[(unsigned char)c];
+    }
+
+    if (pattern[i] == '$' &&
+        (pattern[i + 1] == '\0' || pattern[i + 1] == '|')) {
+      ADDFLAG(anchors, PLAN_ANCHOR_END);
+      ++i;
+    }
+
+    isok = run_size > 0 && (pattern[i] == '\0' || pattern[i] == '|');
+
+    if (isok) {
+      run[run_size] = '\0';
+      patterns_push(&plan->literals, run);
+      plan->anchors =
+          realloc(plan->anchors, plan->literals.count * sizeof(int));
+      plan->anchors[plan->literals.count - 1] = anchors;
+    }
+  } while (isok && pattern[i++] == '|');
+
+  free(run);
+
+  return isok;
+}
+
+/*
+ * Takes plain chars from the start of `pattern` up to the first thing that
+ * isn't one, a char which is repeated by the next operator doesn't count.
+ * */
+static void collect_prefix(const char *pattern, const unsigned char *fold,
+                           plan_t *plan) {
+  size_t size = strlen(pattern), i = 0;
+  char c = 0;
+  long depth = 0;
+
+  // Top level '|' means there is no common prefix
+  for (size_t j = 0; j < size; ++j) {
+    if (pattern[j] == '\\') {
+      ++j;
+    } else if (pattern[j] == '[') {
+      j = patterns_skip_bracket(pattern, j) - 1;
+    } else if (pattern[j] == '(' || pattern[j] == ')') {
+      depth += pattern[j] == '(' ? 1 : -(depth > 0);
+    } else if (pattern[j] == '|' && depth == 0) {
+      return;
+    }
+  }
+
+  plan->prefix = malloc(size + 1);
+
+  while (read_plain_char(pattern, &i, &c)) {
+    plan->prefix[plan->prefix_size++] = fold[(unsigned char)c];
+  }
+
+  if (plan->prefix_size > 0 && pattern[i] != '\0' &&
+      strchr("*+?{", pattern[i]) != NULL) {
+    --plan->prefix_size;
+  }
+
+  plan->prefix[plan->prefix_size] = '\0';
+
+  if (plan->prefix_size == 0) {
+    free(plan->prefix);
+    plan->prefix = NULL;
+  }
+}
+
+static bool isanchored(const char *pattern) {
+  size_t size = strlen(pattern);
+  return pattern[0] == '^' || (size > 0 && pattern[size - 1] == '$' &&
+                               !(size > 1 && pattern[size - 2] == '\\'));
+}
+
+/*
+ * :returns: Estimated share of lines containing one of `plan->literals`
+ * */
+static double estimate_pass_rate(const plan_t *plan) {
+  double pass_rate = plan->count > 0 ? 0 : 1;
+
+  for (size_t i = 0; i < plan->count && pass_rate < 1; ++i) {
+    double chance = PLAN_LINE_SIZE;
+    for (size_t j = 0; j < plan->sizes[i] && chance > 0; ++j) {
+      chance *= PLAN_CHAR_CHANCE;
+    }
+    pass_rate += chance;
+  }
+
+  return pass_rate < 1 ? pass_rate : 1;
+}
+
+/*
+ * Classifies `pattern` and picks its strategy. Literals are folded through
+ * `fold`, `isfolded` tells that lines will be folded the same way. NULL
+ * `fold` means no byte table matches like pattern does, it gets PLAN_REGEX.
+ * */
+plan_t plan_init(const char *pattern, const unsigned char *fold,
+                 bool isfolded) {
+  plan_t plan = {
+      .class = PLAN_CLASS_GENERAL,
+      .strategy = PLAN_REGEX,
+      .cost = PLAN_COST_REGEX,
+      .pass_rate = 1,
+      .isfolded = isfolded,
+      .isscannable = false,
+      .literals = patterns_init(),
+      .sizes = NULL,
+      .anchors = NULL,
+      .count = 0,
+      .prefix = NULL,
+      .prefix_size = 0,
+  };
+
+  plan.isscannable = fold != NULL && collect_alternatives(pattern, fold, &plan);
+
+  if (fold == NULL) {
+    // Nothing to collect, only `regexec` knows what pattern matches
+  } else if (!plan.isscannable) {
+    patterns_free(&plan.literals);
+    plan.literals = patterns_init();
+    free(plan.anchors);
+    plan.anchors = NULL;
+
+    if (!collect_literals(pattern, fold, &plan.literals)) {
+      patterns_free(&plan.literals);
+      plan.literals = patterns_init();
+    }
+    collect_prefix(pattern, fold, &plan);
+  }
+
+  plan.count = plan.literals.count;
+  plan.sizes = calloc(plan.count + 1, sizeof(size_t));
+  for (size_t i = 0; i < plan.count; ++i) {
+    plan.sizes[i] = strlen(plan.literals.data[i]);
+  }
+
+  bool hasanchors = false;
+  for (size_t i = 0; plan.isscannable && i < plan.count; ++i) {
+    hasanchors = hasanchors || plan.anchors[i] != 0;
+  }
+
+  if (plan.isscannable) {
+    plan.class = hasanchors ? PLAN_CLASS_ANCHORED : PLAN_CLASS_LITERAL;
+  } else if (isanchored(pattern)) {
+    plan.class = PLAN_CLASS_ANCHORED;
+  } else if (plan.prefix != NULL) {
+    plan.class = PLAN_CLASS_LITERAL_PREFIX;
+  }
+
+  plan.pass_rate = estimate_pass_rate(&plan);
+  plan.strategy = plan_pick(&plan, plan.pass_rate, &plan.cost);
+
+  return plan;
+}
+
+void plan_free(plan_t *plan) {
+  patterns_free(&plan->literals);
+  free(plan->sizes);
+  free(plan->anchors);
+  free(plan->prefix);
+}
+
+/*
+ * NOTE(wittenbb): Every literal costs a `memmem` per line, past some count
+ * plain `regexec` is cheaper, and sampling them wouldn't pay either.
+ * */
+bool plan_hasprefilter(const plan_t *plan) {
+  return plan->count > 0 && plan->count <= PLAN_PREFILTER_MAX_LITERALS;
+}
+
+double plan_cost(const plan_t *plan, plan_strategy_t strategy,
+                 double pass_rate) {
+  double fold = plan->isfolded ? PLAN_COST_FOLD : 0;
+  double cost = PLAN_COST_REGEX;
+
+  if (strategy == PLAN_SCAN) {
+    cost = fold + PLAN_COST_SCAN * plan->count;
+  } else if (strategy == PLAN_SEEK) {
+    cost = fold + PLAN_COST_SCAN +
+           pass_rate * PLAN_COST_REGEX * (1 - PLAN_SEEK_SKIPPED);
+  } else if (strategy == PLAN_PREFILTER) {
+    cost = fold + PLAN_COST_SCAN * plan->count + pass_rate * PLAN_COST_REGEX;
+  }
+
+  return cost;
+}
+
+/*
+ * :returns: The cheapest strategy pattern of `plan` can be searched with if
+ *           `pass_rate` of lines pass its literals, its cost goes to `cost`
+ * */
+plan_strategy_t plan_pick(const plan_t *plan, double pass_rate, double *cost) {
+  plan_strategy_t best = PLAN_REGEX;
+  *cost = plan_cost(plan, PLAN_REGEX, pass_rate);
+
+  bool isallowed[] = {
+      [PLAN_SCAN] = plan->isscannable,
+      [PLAN_SEEK] = plan->prefix != NULL,
+      [PLAN_PREFILTER] = !plan->isscannable && plan_hasprefilter(plan),
+      [PLAN_REGEX] = true,
+  };
+
+  for (plan_strategy_t strategy = PLAN_SCAN; strategy < PLAN_REGEX;
+       ++strategy) {
+    double strategy_cost = plan_cost(plan, strategy, pass_rate);
+    if (isallowed[strategy] && strategy_cost < *cost) {
+      best = strategy;
+      *cost = strategy_cost;
+    }
+  }
+
+  return best;
+}
+
+const char *plan_class_name(plan_class_t class) {
+  static const char *NAMES[] = {
+      [PLAN_CLASS_LITERAL] = "literal",
+      [PLAN_CLASS_LITERAL_PREFIX] = "literal-prefix",
+      [PLAN_CLASS_ANCHORED] = "anchored",
+      [PLAN_CLASS_GENERAL] = "general",
+  };
+  return NAMES[class];
+}
+
+const char *plan_strategy_name(plan_strategy_t strategy) {
+  static const char *NAMES[] = {
+      [PLAN_SCAN] = "scan",
+      [PLAN_SEEK] = "seek",
+      [PLAN_PREFILTER] = "prefilter",
+      [PLAN_REGEX] = "regex",
+  };
+  return NAMES[strategy];
+}
@@ -0,0 +1,84 @@
+#ifndef GREP_PLAN_H_
+#define GREP_PLAN_H_
+
+/*
+ * Planner of the search engine, part of libs21grep.
+ *
+ * Every pattern left after `patterns_optimize` is classified by its shape
+ * and gets the strategy which is the cheapest by a simple cost model. Costs
+ * are made up units per byte of input, only their ratios mean anything.
+ * Estimated share of lines which pass literals of the pattern is the only
+ * input of the model, so engine re-plans with the measured share once it
+ * has seen some input.
+ * */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "patterns.h"
+#include "sstd/bits.h"
+
+// Patterns with more required literals than that aren't prefiltered by them
+#define PLAN_PREFILTER_MAX_LITERALS 8
+
+// One `memmem` over a byte of line, -i folds a line once for all patterns
+#define PLAN_COST_SCAN 1.0
+#define PLAN_COST_FOLD 1.0
+
+// One `regexec` over a byte of line, in glibc it's a DFA built on the fly
+#define PLAN_COST_REGEX 40.0
+
+// `regexec` started at the literal prefix skips that much of line on average
+#define PLAN_SEEK_SKIPPED 0.5
+
+// Chance of a byte starting some given char, lines are assumed to be ~80
+// bytes of text which uses 16 chars or so most of the time
+#define PLAN_CHAR_CHANCE (1.0 / 16)
+#define PLAN_LINE_SIZE 80
+
+#define PLAN_ANCHOR_BEGIN MKFLAG(0)
+#define PLAN_ANCHOR_END MKFLAG(1)
+
+typedef enum {
+  PLAN_CLASS_LITERAL,         // Plain string or `s1|s2|...` of them
+  PLAN_CLASS_LITERAL_PREFIX,  // Starts with plain string, rest needs regex
+  PLAN_CLASS_ANCHORED,        // Tied to line start or end by '^' or '$'
+  PLAN_CLASS_GENERAL,
+} plan_class_t;
+
+typedef enum {
+  PLAN_SCAN,       // `memmem` for every alternative, no `regexec` at all
+  PLAN_SEEK,       // `memmem` for prefix, `regexec` starts where it's found
+  PLAN_PREFILTER,  // `regexec` only lines with one of required literals
+  PLAN_REGEX,      // `regexec` every line
+} plan_strategy_t;
+
+typedef struct {
+  plan_class_t class;
+  plan_strategy_t strategy;
+  double cost;
+  double pass_rate;  // Estimated share of lines with one of `literals`
+  bool isfolded;     // Lines are folded for -i before `memmem`
+  bool isscannable;  // `literals` are all alternatives of pattern
+  // Folded. Alternatives if `isscannable`, required literals otherwise
+  patterns_t literals;
+  size_t *sizes;
+  int *anchors;  // PLAN_ANCHOR_* of alternatives, only if `isscannable`
+  size_t count;
+  char *prefix;  // Folded, NULL if pattern has no literal prefix
+  size_t prefix_size;
+} plan_t;
+
+plan_t plan_init(const char *pattern, const unsigned char *fold,
+                 bool isfolded);
+void plan_free(plan_t *plan);
+
+bool plan_hasprefilter(const plan_t *plan);
+double plan_cost(const plan_t *plan, plan_strategy_t strategy,
+                 double pass_rate);
+plan_strategy_t plan_pick(const plan_t *plan, double pass_rate, double *cost);
+
+const char *plan_class_name(plan_class_t class);
+const char *plan_strategy_name(plan_strategy_t strategy);
+
+#endif  // GREP_PLAN_H_
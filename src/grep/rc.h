@@ -1,6 +1,13 @@
 #ifndef GREP_RC_H_
 #define GREP_RC_H_
 
+// libs21grep is built with -fvisibility=hidden, only its API is exported
+#ifdef __GNUC__
+#define GREP_API __attribute__((visibility("default")))
+#else
+#define GREP_API
+#endif  // __GNUC__
+
 /*
  * Return Code
  * */
@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+#include "reader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "sstd/iomem.h"
+
+reader_t reader_init(int fd, unsigned long long offset) {
+  return reader_init_limited(fd, offset, 0);
+}
+
+reader_t reader_init_limited(int fd, unsigned long long offset, size_t limit) {
+  reader_t reader = {
+      .fd = fd,
+      .data = NULL,
+      .capacity = 0,
+      .limit = limit,
+      .begin = 0,
+      .scanned = 0,
+      .end = 0,
+      .offset = offset,
+      .saved_at = 0,
+      .saved = '\0',
+      .iseof = false,
+      .iscut = false,
+      .line_offset = 0,
+      .owned_until = 0,
+  };
+
+  if (offset > 0 && lseek(fd, (off_t)offset, SEEK_SET) == -1) {
+    reader.iseof = true;
+  }
+
+  return reader;
+}
+
+/*
+ * Regular files which are big enough start with a block of one huge page,
+ * it costs one TLB entry and 32 times fewer `read` calls.
+ * */
+static size_t reader_first_block_size(const reader_t *reader) {
+  struct stat st;
+  bool isbig = fstat(reader->fd, &st) == 0 && S_ISREG(st.st_mode) &&
+               (unsigned long long)st.st_size >=
+                   reader->offset + IOMEM_HUGE_PAGE_SIZE;
+
+  return isbig ? IOMEM_HUGE_PAGE_SIZE : READER_BLOCK_SIZE;
+}
+
+/*
+ * Moves the unread tail to the beginning of the block (growing it if the tail
+ * fills it up) and reads more after it.
+ *
+ * NOTE(wittenbb): One byte is always kept spare, so there is a place for the
+ * '\0' after the last line.
+ * */
+static void reader_fill(reader_t *reader) {
+  size_t tail_size = reader->end - reader->begin;
+
+  if (reader->begin > 0) {
+    memmove(reader->data, reader->data + reader->begin, tail_size);
+    reader->scanned -= reader->begin;
+    reader->begin = 0;
+    reader->end = tail_size;
+  }
+
+  if (reader->capacity == 0 || reader->end + 1 >= reader->capacity) {
+    size_t capacity = reader->capacity == 0 ? reader_first_block_size(reader)
+                                            : reader->capacity * 2;
+    if (reader->limit > 0 && capacity > reader->limit) {
+      capacity = reader->limit;
+    }
+    reader->data =
+        iomem_resize(reader->data, reader->capacity, capacity, reader->end);
+    reader->capacity = capacity;
+  }
+
+  ssize_t got = read(reader->fd, reader->data + reader->end,
+                     reader->capacity - reader->end - 1);
+
+  if (got > 0) {
+    reader->end += got;
+  } else {
+    reader->iseof = true;
+  }
+}
+
+/*
+ * :returns: Whether the current line takes the whole block it may have
+ * */
+static bool reader_isfull(const reader_t *reader) {
+  return reader->limit > 0 && reader->end - reader->begin + 1 >= reader->limit;
+}
+
+/*
+ * Fills in window part of `line` and moves on to the next window, which
+ * starts half of this one later. Owned part leaves the last quarter of
+ * window for matches to complete in, and the next window starts with it.
+ * */
+static void reader_cut_window(reader_t *reader, line_t *line, bool islast) {
+  if (!reader->iscut) {
+    reader->iscut = true;
+    reader->line_offset = reader->offset;
+    reader->owned_until = reader->offset;
+  }
+
+  line->offset = reader->line_offset;
+  line->iscut = true;
+  line->islast = islast;
+  line->window_offset = reader->offset - reader->line_offset;
+  line->owned_begin = reader->owned_until - reader->offset;
+  line->owned_end = islast ? line->size : line->size - line->size / 4;
+  reader->owned_until = reader->offset + line->owned_end;
+
+  if (islast) {
+    reader->iscut = false;
+  }
+}
+
+bool reader_next_line(reader_t *reader, line_t *line) {
+  if (reader->data != NULL) {
+    reader->data[reader->saved_at] = reader->saved;
+  }
+
+  const char *eol = NULL;
+  bool isfull = false;
+
+  while (eol == NULL && !isfull) {
+    eol = reader->scanned < reader->end
+              ? memchr(reader->data + reader->scanned, '\n',
+                       reader->end - reader->scanned)
+              : NULL;
+    reader->scanned = reader->end;
+
+    if (eol == NULL) {
+      if (reader->iseof) {
+        break;
+      }
+
+      isfull = reader_isfull(reader);
+      if (!isfull) {
+        reader_fill(reader);
+      }
+    }
+  }
+
+  size_t line_end = eol != NULL ? (size_t)(eol - reader->data) + 1 : reader->end;
+
+  if (line_end == reader->begin) {
+    return false;
+  }
+
+  *line = (line_t){
+      .data = reader->data + reader->begin,
+      .size = line_end - reader->begin,
+      .offset = reader->offset,
+  };
+
+  if (isfull || reader->iscut) {
+    reader_cut_window(reader, line, !isfull);
+  }
+
+  size_t step = isfull ? line->size / 2 : line->size;
+
+  reader->saved_at = line_end;
+  reader->saved = reader->data[line_end];
+  reader->data[line_end] = '\0';
+  reader->offset += step;
+  reader->begin += step;
+  reader->scanned = line_end;
+
+  return true;
+}
+
+void reader_free(reader_t *reader) {
+  iomem_free(reader->data, reader->capacity);
+  reader->data = NULL;
+  reader->capacity = 0;
+}
@@ -0,0 +1,65 @@
+#ifndef GREP_READER_H_
+#define GREP_READER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Initial size of block, grows twice whenever a line doesn't fit in it.
+// Blocks of IOMEM_HUGE_PAGE_SIZE and bigger are backed by huge pages
+#define READER_BLOCK_SIZE (1 << 16)
+
+// Smallest limit of block size, windows of cut lines need some room
+#define READER_MIN_LIMIT 64
+
+/*
+ * Reads file by big blocks and cuts them into lines, keeping track of the
+ * absolute offset of every line.
+ *
+ * Block never grows past `limit` (if it's not 0). Lines which don't fit in it
+ * come in windows instead, see `line_t`.
+ * */
+typedef struct {
+  int fd;
+  char *data;
+  size_t capacity;
+  size_t limit;
+  size_t begin;    // Start of the next line in `data`
+  size_t scanned;  // Everything in [begin, scanned) is known to have no '\n'
+  size_t end;      // End of data read so far
+  unsigned long long offset;  // Absolute offset of `data[begin]`
+  size_t saved_at;
+  char saved;      // Char overwritten by the '\0' after the last line
+  bool iseof;
+  bool iscut;      // In the middle of a line which didn't fit
+  unsigned long long line_offset;  // Absolute offset of that line
+  unsigned long long owned_until;  // End of its windows' owned parts so far
+} reader_t;
+
+/*
+ * Line with its '\n' (if any). `data` is nullterminated and valid until the
+ * next call of `reader_next_line`.
+ *
+ * Lines longer than reader's limit come in overlapping windows (`iscut`),
+ * `data` is then `window_offset` bytes into the line at `offset`. Every byte
+ * of the line is owned by exactly one window, [owned_begin, owned_end) of
+ * `data`. Bytes around it are there for context: a match is taken from the
+ * window it starts in the owned part of, it's complete unless it's longer
+ * than the part after `owned_end`.
+ * */
+typedef struct {
+  char *data;
+  size_t size;
+  unsigned long long offset;
+  bool iscut;
+  bool islast;  // Window reaches the end of the line
+  unsigned long long window_offset;
+  size_t owned_begin;
+  size_t owned_end;
+} line_t;
+
+reader_t reader_init(int fd, unsigned long long offset);
+reader_t reader_init_limited(int fd, unsigned long long offset, size_t limit);
+bool reader_next_line(reader_t *reader, line_t *line);
+void reader_free(reader_t *reader);
+
+#endif  // GREP_READER_H_
@@ -0,0 +1,1070 @@
+#define _GNU_SOURCE
+#include "server.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "json.h"
+#include "sstd/color.h"
+#include "sstd/iomem.h"
+#include "sstd/memory.h"
+#include "sstd/utf8.h"
+
+// Bigger requests are dropped, so a broken client can't eat all memory
+#define SERVER_MAX_REQUEST_SIZE (1 << 24)
+
+// Whole request has to arrive in this time, a stalled client can't hold
+// a worker forever
+#define SERVER_REQUEST_TIMEOUT_MS 5000
+
+// Pause before accepting again once descriptors or memory ran out
+#define SERVER_ACCEPT_BACKOFF_MS 100
+
+#define PROTOCOL_MAGIC "s21grep/1"
+
+/*
+ * Both directions are plain byte streams. Request is a list of
+ * nullterminated fields:
+ *
+ *     magic optmask pattern_count pattern... file_count (name path)...
+ *
+ * Response is a sequence of frames: type byte, 32-bit native length and
+ * payload. The last one is FRAME_EXIT with the exit code.
+ * */
+typedef enum {
+  FRAME_STDOUT = 'o',
+  FRAME_STDERR = 'e',
+  FRAME_EXIT = 'x',
+} frame_type_t;
+
+typedef struct {
+  char *key;
+  size_t key_size;
+  void *value;
+  void (*free_value)(void *value);
+  size_t refs;  // Cache itself holds one while entry is in it
+  unsigned long long used;
+} cache_entry_t;
+
+/*
+ * Tiny LRU, entries are looked up by bytes of key. Evicted entries live
+ * until the last query using them is done.
+ * */
+typedef struct {
+  pthread_mutex_t lock;
+  cache_entry_t **entries;
+  size_t count;
+  size_t capacity;
+  unsigned long long tick;
+} cache_t;
+
+/*
+ * Contents of file read into memory owned by the server. Mapping it instead
+ * would save a copy, but a mapped file truncated by someone else (log
+ * rotation) kills the whole server with SIGBUS.
+ * */
+typedef struct {
+  char *data;
+  size_t size;
+  size_t capacity;  // What `data` was allocated with
+} server_file_t;
+
+typedef struct {
+  cache_t engines;
+  cache_t files;
+
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  int queue[SERVER_QUEUE_SIZE];
+  size_t queue_head;
+  size_t queue_count;
+  bool isnuma;
+  size_t started;  // Workers which picked their NUMA node so far
+} server_t;
+
+typedef struct {
+  FILE *out;
+  optmask_t optmask;
+  const char *name;
+  const char *end;  // End of the searched buffer
+} query_sink_t;
+
+static bool write_all(int fd, const void *buf, size_t size) {
+  const char *ptr = buf;
+
+  while (size > 0) {
+    ssize_t written = write(fd, ptr, size);
+
+    if (written == -1 && errno == EINTR) {
+      continue;
+    } else if (written <= 0) {
+      return false;
+    }
+
+    ptr += written;
+    size -= written;
+  }
+
+  return true;
+}
+
+static bool read_all(int fd, void *buf, size_t size) {
+  char *ptr = buf;
+
+  while (size > 0) {
+    ssize_t got = read(fd, ptr, size);
+
+    if (got == -1 && errno == EINTR) {
+      continue;
+    } else if (got <= 0) {
+      return false;
+    }
+
+    ptr += got;
+    size -= got;
+  }
+
+  return true;
+}
+
+static bool send_frame(int fd, frame_type_t type, const void *data,
+                       uint32_t size) {
+  char header[sizeof(char) + sizeof(uint32_t)];
+  header[0] = (char)type;
+  memcpy(header + 1, &size, sizeof(size));
+
+  return write_all(fd, header, sizeof(header)) && write_all(fd, data, size);
+}
+
+static ssize_t frame_cookie_write(void *cookie, const char *buf, size_t size) {
+  int fd = *(int *)cookie;
+  size_t sent = 0;
+
+  while (sent < size) {
+    uint32_t chunk = size - sent < UINT32_MAX ? size - sent : UINT32_MAX;
+
+    if (!send_frame(fd, FRAME_STDOUT, buf + sent, chunk)) {
+      return -1;
+    }
+    sent += chunk;
+  }
+
+  return (ssize_t)size;
+}
+
+static void send_error(int fd, const char *format, const char *arg) {
+  char message[PATH_MAX + 64];
+  int size = snprintf(message, sizeof(message), format, arg);
+
+  if (size > 0) {
+    send_frame(fd, FRAME_STDERR, message,
+               (size_t)size < sizeof(message) ? (uint32_t)size
+                                              : sizeof(message) - 1);
+  }
+}
+
+static void cache_init(cache_t *cache, size_t capacity) {
+  pthread_mutex_init(&cache->lock, NULL);
+  cache->entries = calloc(capacity, sizeof(cache_entry_t *));
+  cache->count = 0;
+  cache->capacity = capacity;
+  cache->tick = 0;
+}
+
+static cache_entry_t *cache_entry_new(const char *key, size_t key_size,
+                                      void *value,
+                                      void (*free_value)(void *value),
+                                      size_t refs) {
+  cache_entry_t *entry = calloc(1, sizeof(cache_entry_t));
+  entry->key = malloc(key_size);
+  memcpy(entry->key, key, key_size);
+  entry->key_size = key_size;
+  entry->value = value;
+  entry->free_value = free_value;
+  entry->refs = refs;
+
+  return entry;
+}
+
+static void cache_entry_unref(cache_entry_t *entry) {
+  if (--entry->refs == 0) {
+    entry->free_value(entry->value);
+    free(entry->key);
+    free(entry);
+  }
+}
+
+/*
+ * :returns: Entry with a reference held for the caller, or NULL
+ * */
+static cache_entry_t *cache_get(cache_t *cache, const char *key,
+                                size_t key_size) {
+  cache_entry_t *found = NULL;
+
+  pthread_mutex_lock(&cache->lock);
+  for (size_t i = 0; found == NULL && i < cache->count; ++i) {
+    cache_entry_t *entry = cache->entries[i];
+
+    if (entry->key_size == key_size &&
+        memcmp(entry->key, key, key_size) == 0) {
+      found = entry;
+      found->used = ++cache->tick;
+      ++found->refs;
+    }
+  }
+  pthread_mutex_unlock(&cache->lock);
+
+  return found;
+}
+
+/*
+ * Inserts `value` evicting the least recently used entry if needed. If
+ * someone put the same key meanwhile, `value` is freed and theirs is used.
+ *
+ * :returns: Entry with a reference held for the caller
+ * */
+static cache_entry_t *cache_put(cache_t *cache, const char *key,
+                                size_t key_size, void *value,
+                                void (*free_value)(void *value)) {
+  cache_entry_t *found = cache_get(cache, key, key_size);
+
+  if (found != NULL) {
+    free_value(value);
+    return found;
+  }
+
+  found = cache_entry_new(key, key_size, value, free_value, 2);
+
+  pthread_mutex_lock(&cache->lock);
+  if (cache->count == cache->capacity) {
+    size_t lru = 0;
+    for (size_t i = 1; i < cache->count; ++i) {
+      if (cache->entries[i]->used < cache->entries[lru]->used) {
+        lru = i;
+      }
+    }
+
+    cache_entry_unref(cache->entries[lru]);
+    cache->entries[lru] = cache->entries[--cache->count];
+  }
+
+  found->used = ++cache->tick;
+  cache->entries[cache->count++] = found;
+  pthread_mutex_unlock(&cache->lock);
+
+  return found;
+}
+
+static void cache_release(cache_t *cache, cache_entry_t *entry) {
+  pthread_mutex_lock(&cache->lock);
+  cache_entry_unref(entry);
+  pthread_mutex_unlock(&cache->lock);
+}
+
+static void free_engine_value(void *value) { engine_free(value); }
+
+static void free_file_value(void *value) {
+  server_file_t *file = value;
+
+  iomem_free(file->data, file->capacity);
+  free(file);
+}
+
+static int make_engine_flags(optmask_t optmask) {
+  int flags = 0;
+
+  if (HASFLAG(optmask, OPT_IGNORE_CASE)) {
+    ADDFLAG(flags, ENGINE_IGNORE_CASE);
+  }
+  if (HASFLAG(optmask, OPT_INVERT_MATCH)) {
+    ADDFLAG(flags, ENGINE_INVERT_MATCH);
+  }
+
+  return flags;
+}
+
+/*
+ * NOTE(wittenbb): Keyed by patterns and the part of `optmask` the engine is
+ * compiled with, queries differing only in output flags share it.
+ * */
+static cache_entry_t *server_get_engine(server_t *server, optmask_t optmask,
+                                        const patterns_t *patterns,
+                                        rc_t *rc) {
+  int flags = make_engine_flags(optmask);
+  size_t key_size = sizeof(flags);
+
+  for (size_t i = 0; i < patterns->count; ++i) {
+    key_size += strlen(patterns->data[i]) + 1;
+  }
+
+  char *key = malloc(key_size);
+  size_t key_off = sizeof(flags);
+  memcpy(key, &flags, sizeof(flags));
+
+  for (size_t i = 0; i < patterns->count; ++i) {
+    size_t size = strlen(patterns->data[i]) + 1;
+    memcpy(key + key_off, patterns->data[i], size);
+    key_off += size;
+  }
+
+  cache_entry_t *entry = cache_get(&server->engines, key, key_size);
+  engine_t *engine = NULL;
+
+  *rc = RC_OK;
+
+  if (entry == NULL && (*rc = engine_compile(&engine, patterns, flags)) ==
+                           RC_OK) {
+    entry = cache_put(&server->engines, key, key_size, engine,
+                      free_engine_value);
+  }
+
+  free(key);
+
+  return entry;
+}
+
+/*
+ * Reads up to `size` bytes, less if file was truncated meanwhile.
+ *
+ * :returns: NULL if file can't be read or out of memory
+ * */
+static server_file_t *server_read_file(int fd, size_t size) {
+  server_file_t *file = calloc(1, sizeof(server_file_t));
+  file->data = iomem_alloc(size);
+  file->capacity = size;
+
+  while (file->data != NULL && file->size < size) {
+    ssize_t got = pread(fd, file->data + file->size, size - file->size,
+                        (off_t)file->size);
+
+    if (got == -1 && errno == EINTR) {
+      continue;
+    } else if (got == -1) {
+      free_file_value(file);
+      return NULL;
+    } else if (got == 0) {
+      break;
+    }
+    file->size += got;
+  }
+
+  if (file->data == NULL) {
+    free(file);
+    file = NULL;
+  }
+
+  return file;
+}
+
+/*
+ * NOTE(wittenbb): Identity and mtime of file are part of the key, so
+ * rewritten files get read again and stale copies just age out. Files too
+ * big for the cache get an entry of their own, freed on `cache_release`.
+ * */
+static cache_entry_t *server_get_file(server_t *server, const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+
+  if (fd == -1) {
+    return NULL;
+  } else if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return NULL;
+  }
+
+  unsigned long long identity[] = {
+      st.st_dev,          st.st_ino,           st.st_size,
+      st.st_mtim.tv_sec,  st.st_mtim.tv_nsec,
+  };
+  size_t path_size = strlen(path) + 1;
+  size_t key_size = path_size + sizeof(identity);
+  char *key = malloc(key_size);
+  memcpy(key, path, path_size);
+  memcpy(key + path_size, identity, sizeof(identity));
+
+  cache_entry_t *entry = cache_get(&server->files, key, key_size);
+  server_file_t *file = NULL;
+
+  if (entry == NULL && (file = server_read_file(fd, st.st_size)) != NULL) {
+    entry = (size_t)st.st_size <= SERVER_MAX_CACHED_FILE_SIZE
+                ? cache_put(&server->files, key, key_size, file,
+                            free_file_value)
+                : cache_entry_new(key, key_size, file, free_file_value, 1);
+  }
+
+  free(key);
+  close(fd);
+
+  return entry;
+}
+
+static void print_query_number(FILE *out, optmask_t optmask,
+                               size_t number) {
+  if (HASFLAG(optmask, OPT_NO_COLOR)) {
+    fprintf(out, "%zu:", number);
+  } else {
+    F_USE_FG(out, LINENUM_COLOR) { fprintf(out, "%zu", number); }
+    {
+      F_USE_FG(out, LINESEP_COLOR) { putc_unlocked(':', out); }
+    }
+  }
+}
+
+static void print_query_name(FILE *out, optmask_t optmask, const char *name) {
+  if (HASFLAG(optmask, OPT_NO_COLOR)) {
+    fprintf(out, "%s:", name);
+  } else {
+    F_USE_FG(out, FILENAME_COLOR) { fputs(name, out); }
+    {
+      F_USE_FG(out, LINESEP_COLOR) { putc_unlocked(':', out); }
+    }
+  }
+}
+
+static void print_query_prefix(const query_sink_t *sink, size_t line_number,
+                               size_t offset) {
+  if (!HASFLAG(sink->optmask, OPT_NO_FILENAME)) {
+    print_query_name(sink->out, sink->optmask, sink->name);
+  }
+  if (HASFLAG(sink->optmask, OPT_LINE_NUMBER)) {
+    print_query_number(sink->out, sink->optmask, line_number);
+  }
+  if (HASFLAG(sink->optmask, OPT_BYTE_OFFSET)) {
+    print_query_number(sink->out, sink->optmask, offset);
+  }
+}
+
+/*
+ * Copies matches of line, with `--utf8` widened to whole characters.
+ *
+ * :returns: Number of matches copied
+ * */
+static size_t copy_query_spans(const query_sink_t *sink,
+                               const engine_match_t *match,
+                               engine_span_t *spans) {
+  bool isutf8 = HASFLAG(sink->optmask, OPT_UTF8);
+
+  for (size_t i = 0; i < match->match_count; ++i) {
+    size_t so = match->matches[i].rm_so, eo = match->matches[i].rm_eo;
+
+    spans[i].so = isutf8 ? utf8_char_start(match->line, match->size, so) : so;
+    spans[i].eo = isutf8 ? utf8_char_end(match->line, match->size, eo) : eo;
+  }
+
+  return match->match_count;
+}
+
+/*
+ * Whole line with union of its matches colored, same as searching locally.
+ * */
+static void print_query_colored(const query_sink_t *sink,
+                                const engine_match_t *match) {
+  FILE *out = sink->out;
+  engine_span_t spans[ENGINE_MAX_MATCHES];
+  size_t span_count = copy_query_spans(sink, match, spans);
+  size_t line_idx = 0;
+
+  engine_sort_spans(spans, span_count);
+
+  for (size_t i = 0; i < span_count; ++i) {
+    size_t match_off = spans[i].so;
+    size_t match_end = spans[i].eo;
+
+    if (match_off < line_idx) {
+      match_off = line_idx;
+    }
+
+    if (match_off < match_end) {
+      fwrite(match->line + line_idx, sizeof(char), match_off - line_idx, out);
+      F_USE_FG(out, MATCH_COLOR) {
+        fwrite(match->line + match_off, sizeof(char), match_end - match_off,
+               out);
+      }
+      line_idx = match_end;
+    }
+  }
+
+  fwrite(match->line + line_idx, sizeof(char), match->size - line_idx, out);
+}
+
+static bool print_query_line(const engine_match_t *match, void *user_data) {
+  query_sink_t *sink = user_data;
+  FILE *out = sink->out;
+
+  if (HASFLAG(sink->optmask, OPT_JSON)) {
+    fputs("{\"path\":", out);
+    json_fput_string(out, sink->name, strlen(sink->name));
+    fprintf(out, ",\"line\":%zu,\"offset\":%zu,\"text\":", match->line_number,
+            match->offset);
+    json_fput_string(out, match->line, match->size);
+    fputs(",\"spans\":[", out);
+    for (size_t i = 0; i < match->match_count; ++i) {
+      fprintf(out, "%s[%lld,%lld]", i > 0 ? "," : "",
+              (long long)match->matches[i].rm_so,
+              (long long)match->matches[i].rm_eo);
+    }
+    fputs("]}\n", out);
+  } else if (HASFLAG(sink->optmask, OPT_ONLY_MATCHING)) {
+    engine_span_t spans[ENGINE_MAX_MATCHES];
+    size_t span_count = engine_disjoint_spans(
+        spans, copy_query_spans(sink, match, spans));
+
+    for (size_t i = 0; i < span_count; ++i) {
+      const char *text = match->line + spans[i].so;
+      size_t text_size = spans[i].eo - spans[i].so;
+
+      print_query_prefix(sink, match->line_number,
+                         match->offset + spans[i].so);
+      if (HASFLAG(sink->optmask, OPT_NO_COLOR)) {
+        fwrite(text, sizeof(char), text_size, out);
+      } else {
+        F_USE_FG(out, MATCH_COLOR) {
+          fwrite(text, sizeof(char), text_size, out);
+        }
+      }
+      putc_unlocked('\n', out);
+    }
+  } else {
+    print_query_prefix(sink, match->line_number, match->offset);
+    if (HASFLAG(sink->optmask, OPT_NO_COLOR) || match->match_count == 0) {
+      fwrite(match->line, sizeof(char), match->size, out);
+    } else {
+      print_query_colored(sink, match);
+    }
+    // Last line of a file may have no '\n', local output keeps it that way
+    if (match->line + match->size < sink->end) {
+      putc_unlocked('\n', out);
+    }
+  }
+
+  return true;
+}
+
+static bool stop_at_first_line(const engine_match_t *match, void *user_data) {
+  KEEP(match);
+  KEEP(user_data);
+  return false;
+}
+
+static void print_query_summary(FILE *out, optmask_t optmask,
+                                const char *name, size_t selected) {
+  bool isjson = HASFLAG(optmask, OPT_JSON);
+
+  if (HASFLAG(optmask, OPT_FILES_WITH_MATCHES) && selected > 0) {
+    if (isjson) {
+      fputs("{\"path\":", out);
+      json_fput_string(out, name, strlen(name));
+      fputs("}\n", out);
+    } else if (HASFLAG(optmask, OPT_NO_COLOR)) {
+      fprintf(out, "%s\n", name);
+    } else {
+      F_USE_FG(out, FILENAME_COLOR) { fprintf(out, "%s\n", name); }
+    }
+  }
+
+  if (HASFLAG(optmask, OPT_COUNT)) {
+    if (isjson) {
+      fputs("{\"path\":", out);
+      json_fput_string(out, name, strlen(name));
+      fprintf(out, ",\"count\":%zu}\n", selected);
+    } else {
+      if (!HASFLAG(optmask, OPT_NO_FILENAME)) {
+        print_query_name(out, optmask, name);
+      }
+      fprintf(out, "%zu\n", selected);
+    }
+  }
+}
+
+static const char *next_field(const char **cursor, const char *end) {
+  const char *field = *cursor;
+  const char *nul = field < end ? memchr(field, '\0', end - field) : NULL;
+
+  if (nul == NULL) {
+    return NULL;
+  }
+
+  *cursor = nul + 1;
+  return field;
+}
+
+static bool next_count(const char **cursor, const char *end, size_t *value) {
+  const char *field = next_field(cursor, end);
+  char *field_end = NULL;
+
+  if (field == NULL) {
+    return false;
+  }
+
+  *value = strtoul(field, &field_end, 10);
+  return *field != '\0' && *field_end == '\0';
+}
+
+static rc_t server_answer(server_t *server, int fd, const char *request,
+                          size_t request_size) {
+  const char *cursor = request, *end = request + request_size;
+  const char *magic = next_field(&cursor, end);
+  size_t optmask = 0, pattern_count = 0, file_count = 0;
+  patterns_t patterns = patterns_init();
+  rc_t rc = RC_ERROR;
+
+  if (magic == NULL || strcmp(magic, PROTOCOL_MAGIC) != 0 ||
+      !next_count(&cursor, end, &optmask) ||
+      !next_count(&cursor, end, &pattern_count)) {
+    send_error(fd, "error: %s: Malformed request\n", "server");
+    return RC_ERROR;
+  }
+
+  for (size_t i = 0; i < pattern_count; ++i) {
+    const char *pattern = next_field(&cursor, end);
+
+    if (pattern == NULL) {
+      send_error(fd, "error: %s: Malformed request\n", "server");
+      patterns_free(&patterns);
+      return RC_ERROR;
+    }
+    patterns_push(&patterns, pattern);
+  }
+
+  cache_entry_t *engine = server_get_engine(server, optmask, &patterns, &rc);
+  patterns_free(&patterns);
+
+  if (engine == NULL) {
+    if (rc == RC_ERROR) {
+      send_error(fd, "error: %s\n", "Failed to compile patterns");
+    }
+    return rc;
+  }
+
+  int cookie_fd = fd;
+  FILE *out = fopencookie(&cookie_fd, "w",
+                          (cookie_io_functions_t){
+                              .read = NULL,
+                              .write = frame_cookie_write,
+                              .seek = NULL,
+                              .close = NULL,
+                          });
+  bool isanyselected = false, isanyfailed = !next_count(&cursor, end,
+                                                         &file_count);
+
+  for (size_t i = 0; out != NULL && i < file_count; ++i) {
+    const char *name = next_field(&cursor, end);
+    const char *path = next_field(&cursor, end);
+
+    if (name == NULL || path == NULL) {
+      isanyfailed = true;
+      break;
+    }
+
+    cache_entry_t *file_entry = server_get_file(server, path);
+
+    if (file_entry == NULL) {
+      // Keep order of output and errors the same as without server
+      if (!HASFLAG(optmask, OPT_NO_MESSAGES)) {
+        fflush(out);
+        send_error(fd, "error: %s: No such file or directory\n", name);
+      }
+      isanyfailed = true;
+      continue;
+    }
+
+    const server_file_t *file = file_entry->value;
+    query_sink_t sink = {
+        .out = out,
+        .optmask = optmask,
+        .name = name,
+        .end = file->data + file->size,
+    };
+    engine_sink_t print = print_query_line;
+    size_t selected = 0;
+
+    if (HASFLAG(optmask, OPT_COUNT)) {
+      print = NULL;
+    } else if (HASFLAG(optmask, OPT_FILES_WITH_MATCHES)) {
+      print = stop_at_first_line;
+    }
+
+    if (engine_search_buf(engine->value, file->data, file->size, print,
+                          &sink, &selected) != RC_OK) {
+      isanyfailed = true;
+    }
+
+    print_query_summary(out, optmask, name, selected);
+    isanyselected = isanyselected || selected > 0;
+
+    cache_release(&server->files, file_entry);
+  }
+
+  if (out != NULL) {
+    fclose(out);
+  }
+  cache_release(&server->engines, engine);
+
+  if (out == NULL || isanyfailed) {
+    rc = RC_ERROR;
+  } else {
+    rc = isanyselected ? RC_OK : RC_PATTERN_NOT_FOUND;
+  }
+
+  return rc;
+}
+
+static long long monotonic_ms(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * Waits until `fd` has something to read.
+ *
+ * :returns: false if `deadline_ms` passed first or `poll` failed
+ * */
+static bool server_wait_readable(int fd, long long deadline_ms) {
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  long long left = 0;
+  int ready = 0;
+
+  while ((left = deadline_ms - monotonic_ms()) > 0 &&
+         (ready = poll(&pfd, 1, (int)left)) == -1 && errno == EINTR) {
+  }
+
+  return left > 0 && ready > 0;
+}
+
+static void server_handle(server_t *server, int fd) {
+  size_t capacity = 1 << 12, size = 0;
+  char *request = malloc(capacity);
+  ssize_t got = 0;
+  long long deadline_ms = monotonic_ms() + SERVER_REQUEST_TIMEOUT_MS;
+
+  while (size < SERVER_MAX_REQUEST_SIZE) {
+    if (!server_wait_readable(fd, deadline_ms)) {
+      got = -1;
+      break;
+    }
+
+    got = read(fd, request + size, capacity - size);
+    if (got == -1 && errno == EINTR) {
+      continue;
+    } else if (got <= 0) {
+      break;
+    }
+    size += got;
+
+    if (size == capacity) {
+      capacity *= 2;
+      request = realloc(request, capacity);
+    }
+  }
+
+  int32_t exit_code = got == 0 ? server_answer(server, fd, request, size)
+                               : RC_ERROR;
+  send_frame(fd, FRAME_EXIT, &exit_code, sizeof(exit_code));
+
+  free(request);
+  close(fd);
+}
+
+static void *server_worker_run(void *arg) {
+  server_t *server = arg;
+
+  if (server->isnuma) {
+    pthread_mutex_lock(&server->lock);
+    size_t index = server->started++;
+    pthread_mutex_unlock(&server->lock);
+
+    iomem_numa_pin(index);
+  }
+
+  while (true) {
+    pthread_mutex_lock(&server->lock);
+    while (server->queue_count == 0) {
+      pthread_cond_wait(&server->changed, &server->lock);
+    }
+
+    int fd = server->queue[server->queue_head];
+    server->queue_head = (server->queue_head + 1) % SERVER_QUEUE_SIZE;
+    --server->queue_count;
+    pthread_cond_broadcast(&server->changed);
+    pthread_mutex_unlock(&server->lock);
+
+    server_handle(server, fd);
+  }
+
+  return NULL;
+}
+
+/*
+ * Removes what's left of a server which is gone, anything else at
+ * `socket_path` (live server, regular file) stays untouched.
+ *
+ * :returns: RC_ERROR if `socket_path` can't be taken
+ * */
+static rc_t server_claim_path(const char *socket_path,
+                              const struct sockaddr_un *addr) {
+  struct stat st;
+
+  if (lstat(socket_path, &st) != 0) {
+    if (errno == ENOENT) {
+      return RC_OK;
+    }
+    fprintf(stderr, "error: %s: %s\n", socket_path, strerror(errno));
+    return RC_ERROR;
+  } else if (!S_ISSOCK(st.st_mode)) {
+    fprintf(stderr, "error: %s: Exists and is not a socket\n", socket_path);
+    return RC_ERROR;
+  }
+
+  int probe_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int probe_errno = 0;
+
+  if (probe_fd == -1) {
+    fprintf(stderr, "error: %s: %s\n", socket_path, strerror(errno));
+    return RC_ERROR;
+  } else if (connect(probe_fd, (const struct sockaddr *)addr,
+                     sizeof(*addr)) != 0) {
+    probe_errno = errno;
+  }
+  close(probe_fd);
+
+  // Only refused connection says for sure nobody listens there
+  if (probe_errno != ECONNREFUSED) {
+    fprintf(stderr, "error: %s: %s\n", socket_path,
+            probe_errno == 0 ? "Server is already running"
+                             : strerror(probe_errno));
+    return RC_ERROR;
+  } else if (unlink(socket_path) != 0 && errno != ENOENT) {
+    fprintf(stderr, "error: %s: %s\n", socket_path, strerror(errno));
+    return RC_ERROR;
+  }
+
+  return RC_OK;
+}
+
+/*
+ * :returns: false if `accept4` failed for good and server has to stop
+ * */
+static bool server_accept_failed(int error, bool *isbacking_off) {
+  if (error == EINTR || error == ECONNABORTED) {
+    return true;
+  } else if (error == EMFILE || error == ENFILE || error == ENOBUFS ||
+             error == ENOMEM) {
+    // Queries being answered will free some, don't spin until they do
+    struct timespec pause = {
+        .tv_sec = 0,
+        .tv_nsec = SERVER_ACCEPT_BACKOFF_MS * 1000000L,
+    };
+
+    if (!*isbacking_off) {
+      fprintf(stderr, "error: server: %s, waiting\n", strerror(error));
+      *isbacking_off = true;
+    }
+    nanosleep(&pause, NULL);
+    return true;
+  }
+
+  fprintf(stderr, "error: server: %s\n", strerror(error));
+  return false;
+}
+
+rc_t server_run(const char *socket_path, size_t thread_count, bool isnuma) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "error: %s: Socket path is too long\n", socket_path);
+    return RC_ERROR;
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  if (server_claim_path(socket_path, &addr) != RC_OK) {
+    return RC_ERROR;
+  }
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  bool isbound = false;
+
+  // NOTE(wittenbb): Files are opened with our privileges for anyone who can
+  // connect, so socket is born owner-only rather than chmod'ed after bind
+  if (listen_fd != -1) {
+    mode_t old_umask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+    isbound =
+        bind(listen_fd, (const struct sockaddr *)&addr, sizeof(addr)) == 0;
+    umask(old_umask);
+  }
+
+  if (!isbound || listen(listen_fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "error: %s: %s\n", socket_path, strerror(errno));
+    if (listen_fd != -1) {
+      close(listen_fd);
+    }
+    return RC_ERROR;
+  }
+
+  // Clients hanging up in the middle of an answer must not kill us
+  signal(SIGPIPE, SIG_IGN);
+
+  if (thread_count == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = cpus > 0 ? (size_t)cpus : 1;
+  }
+
+  server_t server = {
+      .queue_head = 0,
+      .queue_count = 0,
+      .isnuma = isnuma,
+      .started = 0,
+  };
+  cache_init(&server.engines, SERVER_ENGINE_CACHE_SIZE);
+  cache_init(&server.files, SERVER_FILE_CACHE_SIZE);
+  pthread_mutex_init(&server.lock, NULL);
+  pthread_cond_init(&server.changed, NULL);
+
+  size_t spawned = 0;
+  for (size_t i = 0; i < thread_count; ++i) {
+    pthread_t worker;
+    if (pthread_create(&worker, NULL, server_worker_run, &server) == 0) {
+      pthread_detach(worker);
+      ++spawned;
+    }
+  }
+
+  if (spawned == 0) {
+    fprintf(stderr, "error: Failed to start workers\n");
+    close(listen_fd);
+    return RC_ERROR;
+  }
+
+  bool isbacking_off = false;
+
+  while (true) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+    if (fd == -1) {
+      if (server_accept_failed(errno, &isbacking_off)) {
+        continue;
+      }
+      break;
+    }
+    isbacking_off = false;
+
+    pthread_mutex_lock(&server.lock);
+    while (server.queue_count == SERVER_QUEUE_SIZE) {
+      pthread_cond_wait(&server.changed, &server.lock);
+    }
+
+    server.queue[(server.queue_head + server.queue_count) %
+                 SERVER_QUEUE_SIZE] = fd;
+    ++server.queue_count;
+    pthread_cond_broadcast(&server.changed);
+    pthread_mutex_unlock(&server.lock);
+  }
+
+  // Workers are detached and may still be answering, so nothing is freed
+  close(listen_fd);
+
+  return RC_ERROR;
+}
+
+static void fput_field(FILE *request, const char *field) {
+  fwrite(field, sizeof(char), strlen(field) + 1, request);
+}
+
+rc_t client_run(const char *socket_path, optmask_t optmask,
+                const patterns_t *patterns, char *const *file_paths,
+                size_t file_count) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  int fd = -1;
+
+  if (strlen(socket_path) < sizeof(addr.sun_path)) {
+    strcpy(addr.sun_path, socket_path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  }
+
+  if (fd == -1 ||
+      connect(fd, (const struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "error: %s: Failed to connect to server\n", socket_path);
+    if (fd != -1) {
+      close(fd);
+    }
+    return RC_ERROR;
+  }
+
+  char *request = NULL;
+  size_t request_size = 0;
+  FILE *request_stream = open_memstream(&request, &request_size);
+  char number[32];
+
+  fput_field(request_stream, PROTOCOL_MAGIC);
+  snprintf(number, sizeof(number), "%u", optmask);
+  fput_field(request_stream, number);
+  snprintf(number, sizeof(number), "%zu", patterns->count);
+  fput_field(request_stream, number);
+  for (size_t i = 0; i < patterns->count; ++i) {
+    fput_field(request_stream, patterns->data[i]);
+  }
+
+  // Server has its own working directory, so send absolute paths too
+  snprintf(number, sizeof(number), "%zu", file_count);
+  fput_field(request_stream, number);
+  for (size_t i = 0; i < file_count; ++i) {
+    char *resolved = realpath(file_paths[i], NULL);
+    fput_field(request_stream, file_paths[i]);
+    fput_field(request_stream, resolved != NULL ? resolved : file_paths[i]);
+    free_if_not_null(resolved);
+  }
+  fclose(request_stream);
+
+  rc_t rc = RC_ERROR;
+  bool isok = write_all(fd, request, request_size) &&
+              shutdown(fd, SHUT_WR) == 0;
+  free(request);
+
+  char *payload = NULL;
+  size_t payload_capacity = 0;
+  char header[sizeof(char) + sizeof(uint32_t)];
+
+  while (isok && read_all(fd, header, sizeof(header))) {
+    uint32_t size = 0;
+    memcpy(&size, header + 1, sizeof(size));
+
+    if (size > payload_capacity) {
+      payload_capacity = size;
+      payload = realloc(payload, payload_capacity);
+    }
+
+    if (!read_all(fd, payload, size)) {
+      break;
+    } else if (header[0] == FRAME_STDOUT) {
+      fwrite(payload, sizeof(char), size, stdout);
+    } else if (header[0] == FRAME_STDERR) {
+      fflush(stdout);
+      fwrite(payload, sizeof(char), size, stderr);
+    } else if (header[0] == FRAME_EXIT && size == sizeof(int32_t)) {
+      int32_t exit_code = 0;
+      memcpy(&exit_code, payload, sizeof(exit_code));
+      rc = (rc_t)exit_code;
+      break;
+    }
+  }
+
+  free_if_not_null(payload);
+  close(fd);
+
+  return rc;
+}
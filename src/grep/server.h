@@ -0,0 +1,46 @@
+#ifndef GREP_SERVER_H_
+#define GREP_SERVER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "opts.h"
+#include "patterns.h"
+#include "rc.h"
+
+// Compiled pattern sets kept around between queries
+#define SERVER_ENGINE_CACHE_SIZE 32
+
+// Files kept in memory between queries
+#define SERVER_FILE_CACHE_SIZE 64
+
+// Bigger files are read again for every query instead
+#define SERVER_MAX_CACHED_FILE_SIZE (1 << 26)
+
+// Accepted connections waiting for a free worker
+#define SERVER_QUEUE_SIZE 64
+
+/*
+ * Serves queries on Unix socket `socket_path` forever, `thread_count`
+ * workers (0 means one per CPU) answer them concurrently. With `isnuma`
+ * workers are spread over NUMA nodes.
+ *
+ * Socket is a privilege boundary: server opens paths sent by clients with
+ * its own permissions, so the socket is created with mode 0600 and only
+ * its owner may connect. Loosening that lets others read our files.
+ *
+ * :returns: RC_ERROR if socket can't be set up or stops accepting
+ * */
+rc_t server_run(const char *socket_path, size_t thread_count, bool isnuma);
+
+/*
+ * Sends query to server listening on `socket_path` and streams its output
+ * to stdout and stderr.
+ *
+ * :returns: Exit code of query
+ * */
+rc_t client_run(const char *socket_path, optmask_t optmask,
+                const patterns_t *patterns, char *const *file_paths,
+                size_t file_count);
+
+#endif  // GREP_SERVER_H_
@@ -1,6 +1,6 @@
 #!/usr/bin/python3
 from __future__ import annotations
-from typing import TYPE_CHECKING, Sequence, cast
+from typing import TYPE_CHECKING, List, Sequence, cast
 
 if TYPE_CHECKING:
     from _typeshed import StrPath
@@ -18,6 +18,8 @@ import argparse
 import subprocess
 import logging
 
+from test_fixtures import generated_fixtures
+
 
 logging.basicConfig(
     level=os.getenv("LOG_LEVEL", "INFO"),
@@ -39,6 +41,32 @@ def _raise_if_not_exists(path: StrPath):
         raise FileNotFoundError(f"Unable to find file with given path: {path!r}")
 
 
+# s21_grep patterns are EREs
+REFERENCE_FLAGS = ["-E"]
+
+# Options only s21_grep has and number of their arguments, GNU grep runs
+# without them and has to print the same
+S21_ONLY_OPTIONS = {
+    "--threads": 1,
+    "--max-line-buffer": 1,
+}
+
+
+def strip_s21_only_options(flags: Sequence[str]) -> List[str]:
+    stripped = []
+    skip = 0
+
+    for flag in flags:
+        if skip > 0:
+            skip -= 1
+        elif flag in S21_ONLY_OPTIONS:
+            skip = S21_ONLY_OPTIONS[flag]
+        else:
+            stripped.append(flag)
+
+    return stripped
+
+
 def compare_proc_output(exec_a: StrPath, exec_b: StrPath, flags: Sequence[str]) -> bool:
     template = "{exec} {flags}"
 
@@ -46,7 +74,7 @@ def compare_proc_output(exec_a: StrPath, exec_b: StrPath, flags: Sequence[str])
         shlex.split(
             template.format(
                 exec=exec_a,
-                flags=" ".join(flags),
+                flags=" ".join(shlex.quote(flag) for flag in [*REFERENCE_FLAGS, *strip_s21_only_options(flags)]),
             ),
         ),
         stdout=subprocess.PIPE,
@@ -57,7 +85,7 @@ def compare_proc_output(exec_a: StrPath, exec_b: StrPath, flags: Sequence[str])
         shlex.split(
             template.format(
                 exec=exec_b,
-                flags=" ".join(flags),
+                flags=" ".join(shlex.quote(flag) for flag in flags),
             ),
         ),
         stdout=subprocess.PIPE,
@@ -92,12 +120,13 @@ def main() -> int:
 
     logger.debug(f"flags: {flag_packs}")
 
-    for index, flag_pack in enumerate(flag_packs):
-        if not compare_proc_output(cast(str, GREP_BIN), test_bin, flag_pack):
-            failed_packs.append(flag_pack)
-            logger.error(f"[{index+1:3}] FAILED {flag_pack!r}")
-        else:
-            logger.info(f"[{index+1:3}] PASSED {flag_pack!r}")
+    with generated_fixtures():
+        for index, flag_pack in enumerate(flag_packs):
+            if not compare_proc_output(cast(str, GREP_BIN), test_bin, flag_pack):
+                failed_packs.append(flag_pack)
+                logger.error(f"[{index+1:3}] FAILED {flag_pack!r}")
+            else:
+                logger.info(f"[{index+1:3}] PASSED {flag_pack!r}")
 
     for flag_pack in failed_packs:
         logger.info(f"FAILED: {(' '.join(flag_pack))!r}")
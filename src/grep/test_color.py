@@ -0,0 +1,167 @@
+#!/usr/bin/python3
+from __future__ import annotations
+from typing import TYPE_CHECKING, List, Sequence, Tuple, cast
+
+if TYPE_CHECKING:
+    from _typeshed import StrPath
+
+import sys
+
+if sys.version_info < (3, 7):
+    raise Exception("python>=3.7 is required")
+
+import os
+import os.path
+import re
+import pty
+import select
+import shutil
+import argparse
+import tempfile
+import subprocess
+import logging
+
+from test_server import start_server
+
+
+logging.basicConfig(
+    level=os.getenv("LOG_LEVEL", "INFO"),
+    format="%(message)s",
+)
+
+logger = logging.getLogger("test")
+
+
+
+GREP_BIN = shutil.which("grep")
+
+if GREP_BIN is None:
+    raise FileNotFoundError("Unable to find grep binary in PATH")
+
+# GNU grep never splits a character in UTF-8 locale, s21_grep with --utf8
+# must highlight the same. Its '.' is still one byte, patterns are picked
+# so that doesn't matter
+REFERENCE_ENV = {**os.environ, "LC_ALL": "C.UTF-8"}
+S21_ONLY_FLAGS = ["--utf8"]
+
+FLAG_PACKS = [
+    ["--utf8", "caf.", "test_text_05.txt"],
+    ["--utf8", "-n", "-e", "na.", "-e", "日.", "test_text_05.txt"],
+    ["--utf8", "-e", ".e ", "-e", "..\\t", "test_text_05.txt", "test_text_01.txt"],
+    ["--utf8", "-o", "-e", "stra.", "-e", ".ö", "test_text_05.txt"],
+    ["--utf8", "-e", "[^ ]*€", "-e", ".$", "test_text_05.txt"],
+]
+
+# SGR codes of matches, GNU grep's default and MATCH_COLOR
+MATCH_SGRS = {b"01;31", b"1;31"}
+ESCAPE = re.compile(rb"\x1b\[([0-9;]*)([mK])")
+
+
+def _raise_if_not_exists(path: StrPath):
+    if not os.path.exists(path):
+        raise FileNotFoundError(f"Unable to find file with given path: {path!r}")
+
+
+def run_in_pty(args: Sequence[str]) -> Tuple[bytes, int]:
+    """s21_grep colors output only for terminals"""
+    master, slave = pty.openpty()
+    proc = subprocess.Popen(args, stdout=slave, stderr=subprocess.DEVNULL)
+    output = b""
+
+    # Slave stays open here, so reads never fail with EIO before output is
+    # drained. Done once the process is gone and nothing is left to read
+    while True:
+        isexited = proc.poll() is not None
+        if select.select([master], [], [], 0.05)[0]:
+            output += os.read(master, 1 << 16)
+        elif isexited:
+            break
+
+    os.close(slave)
+    os.close(master)
+
+    return output.replace(b"\r\n", b"\n"), proc.returncode
+
+
+def mark_matches(output: bytes) -> bytes:
+    """Drops escapes, but keeps colored matches as [[...]]"""
+    marked = bytearray()
+    pos = 0
+    ismatch = False
+
+    for escape in ESCAPE.finditer(output):
+        marked += output[pos:escape.start()]
+        pos = escape.end()
+        if escape.group(2) != b"m":
+            continue
+        elif escape.group(1) in MATCH_SGRS and not ismatch:
+            marked += b"[["
+            ismatch = True
+        elif escape.group(1) == b"" and ismatch:
+            marked += b"]]"
+            ismatch = False
+
+    return bytes(marked + output[pos:])
+
+
+def compare_colored_output(test_bin: str, flags: Sequence[str]) -> bool:
+    reference_flags = [flag for flag in flags if flag not in S21_ONLY_FLAGS]
+    proc_a = subprocess.run(
+        [cast(str, GREP_BIN), "--color=always", *reference_flags],
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        env=REFERENCE_ENV,
+    )
+    output_b, returncode_b = run_in_pty([test_bin, *flags])
+
+    marked_a = mark_matches(proc_a.stdout)
+    marked_b = mark_matches(output_b)
+
+    logger.debug(f"A: {marked_a!s}")
+    logger.debug(f"B: {marked_b!s}")
+
+    return marked_a == marked_b and proc_a.returncode == returncode_b
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser()
+    parser.add_argument("test_bin")
+    args = parser.parse_args()
+    test_bin: str = os.path.abspath(args.test_bin)
+
+    _raise_if_not_exists(test_bin)
+
+    failed_packs: List[List[str]] = []
+
+    for index, flag_pack in enumerate(FLAG_PACKS):
+        if not compare_colored_output(test_bin, flag_pack):
+            failed_packs.append(flag_pack)
+            logger.error(f"[{index+1:3}] FAILED {flag_pack!r}")
+        else:
+            logger.info(f"[{index+1:3}] PASSED {flag_pack!r}")
+
+    # Server colors lines on its own, it must print the same bytes
+    with tempfile.TemporaryDirectory() as workdir:
+        socket_path = os.path.join(workdir, "s21_grep.sock")
+        server = start_server(test_bin, socket_path)
+
+        try:
+            for index, flag_pack in enumerate(FLAG_PACKS):
+                client_pack = ["--client", socket_path, *flag_pack]
+                if run_in_pty([test_bin, *flag_pack]) != run_in_pty([test_bin, *client_pack]):
+                    failed_packs.append(client_pack)
+                    logger.error(f"[{index+1:3}] FAILED {client_pack!r}")
+                else:
+                    logger.info(f"[{index+1:3}] PASSED {client_pack!r}")
+        finally:
+            server.terminate()
+            server.wait()
+
+    for flag_pack in failed_packs:
+        logger.info(f"FAILED: {(' '.join(flag_pack))!r}")
+
+    return 1 if failed_packs else 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
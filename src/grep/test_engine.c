@@ -0,0 +1,209 @@
+/*
+ * Checks libs21grep from the outside: one compiled engine searched by
+ * several threads at once gives the same answers as a single thread, and
+ * the shared library exports nothing but GREP_API.
+ *
+ * Usage: test_engine path/to/libs21grep.so
+ * */
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "patterns.h"
+
+#define TEST_THREAD_COUNT 2
+#define TEST_ITERATIONS 16
+
+// Lines of the buffer go round these, so selected ones are known upfront.
+// Buffer is over ENGINE_SAMPLE_SIZE, sets pick strategies again midway
+#define TEST_LINE_COUNT 100000
+#define TEST_SELECTED_PER_ROUND 3
+
+static const char *const TEST_LINES[] = {
+    "alpha lorem ipsum",      // lorem
+    "beta dolor sit amet",    // nothing
+    "gamma pellentesque",     // (l)\1
+    "delta LOREM upper case", // lorem, ignoring case
+    "",                       // nothing
+};
+
+#define TEST_ROUND_SIZE (sizeof(TEST_LINES) / sizeof(*TEST_LINES))
+
+typedef struct {
+  size_t selected;
+  unsigned long long checksum;
+} result_t;
+
+typedef struct {
+  engine_t *engine;
+  const char *buf;
+  size_t size;
+  result_t expected;
+  size_t failures;
+} worker_t;
+
+static bool sum_matches(const engine_match_t *match, void *user_data) {
+  unsigned long long *checksum = user_data;
+
+  *checksum += match->line_number * 31 + match->offset;
+  for (size_t i = 0; i < match->match_count; ++i) {
+    *checksum += (unsigned long long)match->matches[i].rm_so * 7 +
+                 (unsigned long long)match->matches[i].rm_eo;
+  }
+
+  return true;
+}
+
+static rc_t search(engine_t *engine, const char *buf, size_t size,
+                   result_t *result) {
+  result->checksum = 0;
+  return engine_search_buf(engine, buf, size, sum_matches, &result->checksum,
+                           &result->selected);
+}
+
+static void *worker_run(void *arg) {
+  worker_t *worker = arg;
+
+  for (size_t i = 0; i < TEST_ITERATIONS; ++i) {
+    result_t result;
+    if (search(worker->engine, worker->buf, worker->size, &result) != RC_OK ||
+        result.selected != worker->expected.selected ||
+        result.checksum != worker->expected.checksum) {
+      ++worker->failures;
+    }
+  }
+
+  return NULL;
+}
+
+static char *make_buf(size_t *size) {
+  size_t capacity = 0;
+  for (size_t i = 0; i < TEST_ROUND_SIZE; ++i) {
+    capacity += strlen(TEST_LINES[i]) + 1;
+  }
+  capacity *= TEST_LINE_COUNT / TEST_ROUND_SIZE;
+
+  char *buf = malloc(capacity);
+  *size = 0;
+
+  for (size_t i = 0; i < TEST_LINE_COUNT; ++i) {
+    const char *line = TEST_LINES[i % TEST_ROUND_SIZE];
+    size_t line_size = strlen(line);
+    memcpy(buf + *size, line, line_size);
+    *size += line_size;
+    buf[(*size)++] = '\n';
+  }
+
+  return buf;
+}
+
+static bool check(bool isok, const char *what) {
+  if (isok) {
+    printf("PASSED %s\n", what);
+  } else {
+    printf("FAILED: %s\n", what);
+  }
+  return isok;
+}
+
+static bool test_threads(void) {
+  patterns_t patterns = patterns_init();
+  engine_t *engine = NULL;
+  bool isok = true;
+
+  // Literal, backreference (never merged) and a class, so sets hold
+  // several strategies
+  patterns_push(&patterns, "lorem");
+  patterns_push(&patterns, "(l)\\1");
+  patterns_push(&patterns, "si[xy]");
+  patterns_push(&patterns, "lorem");
+
+  if (!check(engine_compile(&engine, &patterns, ENGINE_IGNORE_CASE) == RC_OK,
+             "compile")) {
+    patterns_free(&patterns);
+    return false;
+  }
+
+  size_t size = 0;
+  char *buf = make_buf(&size);
+  result_t expected;
+
+  isok = check(search(engine, buf, size, &expected) == RC_OK &&
+                   expected.selected == TEST_LINE_COUNT / TEST_ROUND_SIZE *
+                                            TEST_SELECTED_PER_ROUND,
+               "single thread") &&
+         isok;
+
+  worker_t workers[TEST_THREAD_COUNT];
+  pthread_t threads[TEST_THREAD_COUNT];
+  size_t started = 0;
+
+  for (size_t i = 0; i < TEST_THREAD_COUNT; ++i) {
+    workers[i] = (worker_t){
+        .engine = engine,
+        .buf = buf,
+        .size = size,
+        .expected = expected,
+        .failures = 0,
+    };
+    if (pthread_create(threads + i, NULL, worker_run, workers + i) == 0) {
+      ++started;
+    }
+  }
+
+  size_t failures = 0;
+  for (size_t i = 0; i < started; ++i) {
+    pthread_join(threads[i], NULL);
+    failures += workers[i].failures;
+  }
+
+  isok = check(started == TEST_THREAD_COUNT && failures == 0,
+               "threads share one engine") &&
+         isok;
+
+  free(buf);
+  engine_free(engine);
+  patterns_free(&patterns);
+
+  return isok;
+}
+
+static bool test_exports(const char *lib_path) {
+  void *lib = dlopen(lib_path, RTLD_NOW | RTLD_LOCAL);
+
+  if (!check(lib != NULL, "dlopen")) {
+    fprintf(stderr, "%s\n", dlerror());
+    return false;
+  }
+
+  bool isok = check(dlsym(lib, "engine_compile") != NULL &&
+                        dlsym(lib, "engine_search_buf") != NULL &&
+                        dlsym(lib, "patterns_optimize") != NULL,
+                    "GREP_API is exported");
+  // Planner and helpers shared between translation units stay inside
+  isok = check(dlsym(lib, "plan_init") == NULL &&
+                   dlsym(lib, "plan_pick") == NULL &&
+                   dlsym(lib, "patterns_skip_bracket") == NULL,
+               "helpers are hidden") &&
+         isok;
+
+  dlclose(lib);
+
+  return isok;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s LIBS21GREP_SO\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  bool isok = test_threads();
+  isok = test_exports(argv[1]) && isok;
+
+  return isok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,36 @@
+from __future__ import annotations
+from typing import Iterator
+
+import os
+import os.path
+import contextlib
+
+
+# Several COUNT_MIN_CHUNK_SIZE chunks, so -c really splits it over threads
+BIG_TEXT = "test_text_big.txt"
+BIG_TEXT_SIZE = 5 << 20
+
+
+def _write_big_text(path: str, source: str):
+    with open(source, "rb") as f:
+        lines = f.read().split(b"\n")
+
+    size = 0
+    with open(path, "wb") as f:
+        # Lines shift every round, chunk edges land mid-line and on blanks
+        for shift in range(BIG_TEXT_SIZE):
+            for line in lines[shift % len(lines):] + [b"", b"x" * shift]:
+                f.write(line + b"\n")
+                size += len(line) + 1
+            if size >= BIG_TEXT_SIZE:
+                break
+
+
+@contextlib.contextmanager
+def generated_fixtures() -> Iterator[None]:
+    """Creates fixtures too big to keep in the repo, removes them after"""
+    _write_big_text(BIG_TEXT, "test_text_01.txt")
+    try:
+        yield
+    finally:
+        os.remove(BIG_TEXT)
@@ -0,0 +1,120 @@
+#!/usr/bin/python3
+from __future__ import annotations
+from typing import TYPE_CHECKING, Any, Dict, List, Sequence
+
+if TYPE_CHECKING:
+    from _typeshed import StrPath
+
+import sys
+
+if sys.version_info < (3, 7):
+    raise Exception("python>=3.7 is required")
+
+import os
+import os.path
+import re
+import json
+import argparse
+import subprocess
+import logging
+
+
+logging.basicConfig(
+    level=os.getenv("LOG_LEVEL", "INFO"),
+    format="%(message)s",
+)
+
+logger = logging.getLogger("test")
+
+
+# Literals to look for (as ERE for s21_grep) and files, lines of
+# test_text_04.txt have quotes, backslashes, tabs, control bytes and UTF-8
+# in them
+CASES = [
+    ({'"': '"', "slash": "slash"}, ["test_text_04.txt", "test_text_03.txt"]),
+    ({"\\\\": "\\", "\x01b": "\x01b", "\x1b[[]": "\x1b["}, ["test_text_04.txt"]),
+    ({"é\x7f": "é\x7f", "\t": "\t"}, ["test_text_04.txt"]),
+]
+
+
+def _raise_if_not_exists(path: StrPath):
+    if not os.path.exists(path):
+        raise FileNotFoundError(f"Unable to find file with given path: {path!r}")
+
+
+def expected_objects(patterns: Sequence[str], files: Sequence[str]) -> List[Dict[str, Any]]:
+    """What --json prints, found with Python on raw bytes of `files`"""
+    regex = re.compile(b"|".join(re.escape(p.encode()) for p in patterns))
+    objects = []
+
+    for path in files:
+        with open(path, "rb") as f:
+            data = f.read()
+
+        offset = 0
+        for number, line in enumerate(data.split(b"\n"), start=1):
+            spans = [[m.start(), m.end()] for m in regex.finditer(line)]
+            if spans:
+                objects.append({
+                    "path": path,
+                    "line": number,
+                    "offset": offset,
+                    "text": line.decode(),
+                    "spans": spans,
+                })
+            offset += len(line) + 1
+
+    return objects
+
+
+def check_case(test_bin: str, patterns: Dict[str, str], files: Sequence[str]) -> bool:
+    args = [test_bin, "--json"]
+    for pattern in patterns:
+        args += ["-e", pattern]
+
+    proc = subprocess.run(
+        [*args, *files],
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+    )
+
+    # Strict parser, control characters left unescaped don't get through
+    try:
+        got = [json.loads(line) for line in proc.stdout.decode().splitlines()]
+    except ValueError as error:
+        logger.error(f"Invalid JSON: {error}")
+        return False
+
+    expected = expected_objects(list(patterns.values()), files)
+
+    logger.debug(f"A: {expected!r}")
+    logger.debug(f"B: {got!r}")
+
+    return got == expected and proc.stderr == b"" and proc.returncode == 0
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser()
+    parser.add_argument("test_bin")
+    args = parser.parse_args()
+    test_bin: str = args.test_bin
+
+    _raise_if_not_exists(test_bin)
+
+    failed_cases = []
+
+    for index, (patterns, files) in enumerate(CASES):
+        if not check_case(test_bin, patterns, files):
+            failed_cases.append((patterns, files))
+            logger.error(f"[{index+1:3}] FAILED {patterns!r} {files!r}")
+        else:
+            logger.info(f"[{index+1:3}] PASSED {patterns!r} {files!r}")
+
+    for patterns, files in failed_cases:
+        logger.info(f"FAILED: {patterns!r} {files!r}")
+
+    return 1 if failed_cases else 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
@@ -0,0 +1,138 @@
+#!/usr/bin/python3
+from __future__ import annotations
+from typing import TYPE_CHECKING, List, Sequence
+
+if TYPE_CHECKING:
+    from _typeshed import StrPath
+
+import sys
+
+if sys.version_info < (3, 7):
+    raise Exception("python>=3.7 is required")
+
+import os
+import os.path
+import stat
+import time
+import shlex
+import argparse
+import tempfile
+import subprocess
+import logging
+
+from test_fixtures import generated_fixtures
+
+
+logging.basicConfig(
+    level=os.getenv("LOG_LEVEL", "INFO"),
+    format="%(message)s",
+)
+
+logger = logging.getLogger("test")
+
+
+SERVER_START_TIMEOUT = 5.0
+
+# Output GNU grep disagrees with, so these can't go into test_flags.txt.
+# Colored output is checked by test_color.py
+EXTRA_FLAG_PACKS = [
+    ["in", "test_text_03.txt"],
+    ["-n", "line", "test_text_03.txt", "test_text_01.txt"],
+    ["--json", "-e", '"', "-e", "slash", "test_text_04.txt", "test_text_03.txt"],
+]
+
+
+def _raise_if_not_exists(path: StrPath):
+    if not os.path.exists(path):
+        raise FileNotFoundError(f"Unable to find file with given path: {path!r}")
+
+
+def start_server(test_bin: str, socket_path: str) -> subprocess.Popen:
+    server = subprocess.Popen(
+        [test_bin, "--serve", socket_path],
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.PIPE,
+    )
+    deadline = time.monotonic() + SERVER_START_TIMEOUT
+
+    while not os.path.exists(socket_path):
+        if server.poll() is not None or time.monotonic() > deadline:
+            server.kill()
+            _, stderr = server.communicate()
+            raise RuntimeError(f"Server failed to start: {stderr!r}")
+        time.sleep(0.05)
+
+    return server
+
+
+def compare_client_output(test_bin: str, socket_path: str,
+                          flags: Sequence[str]) -> bool:
+    proc_a = subprocess.run(
+        [test_bin, *flags],
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+    )
+
+    proc_b = subprocess.run(
+        [test_bin, "--client", socket_path, *flags],
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+    )
+
+    logger.debug("stdout")
+    logger.debug(f"A: {proc_a.stdout!s}")
+    logger.debug(f"B: {proc_b.stdout!s}")
+    logger.debug("stderr")
+    logger.debug(f"A: {proc_a.stderr!s}")
+    logger.debug(f"B: {proc_b.stderr!s}")
+
+    return proc_a.stdout == proc_b.stdout and proc_a.stderr == proc_b.stderr and proc_a.returncode == proc_b.returncode
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser()
+    parser.add_argument("test_bin")
+    parser.add_argument("test_flags")
+    args = parser.parse_args()
+    test_bin: str = os.path.abspath(args.test_bin)
+    test_flags: str = args.test_flags
+
+    _raise_if_not_exists(test_bin)
+    _raise_if_not_exists(test_flags)
+
+    with open(test_flags) as f:
+        flag_packs: List[List[str]] = [shlex.split(line) for line in f.read().split('\n')]
+        flag_packs = [pack for pack in flag_packs if len(pack) > 0]
+    flag_packs += EXTRA_FLAG_PACKS
+
+    failed_packs = []
+
+    with tempfile.TemporaryDirectory() as workdir, generated_fixtures():
+        socket_path = os.path.join(workdir, "s21_grep.sock")
+        server = start_server(test_bin, socket_path)
+
+        try:
+            # Anyone who can connect reads files with our permissions
+            socket_mode = stat.S_IMODE(os.stat(socket_path).st_mode)
+            if socket_mode != 0o600:
+                failed_packs.append(["socket mode", oct(socket_mode)])
+                logger.error(f"FAILED socket mode {oct(socket_mode)}")
+
+            for index, flag_pack in enumerate(flag_packs):
+                if not compare_client_output(test_bin, socket_path, flag_pack):
+                    failed_packs.append(flag_pack)
+                    logger.error(f"[{index+1:3}] FAILED {flag_pack!r}")
+                else:
+                    logger.info(f"[{index+1:3}] PASSED {flag_pack!r}")
+        finally:
+            server.terminate()
+            server.wait()
+
+    for flag_pack in failed_packs:
+        logger.info(f"FAILED: {(' '.join(flag_pack))!r}")
+
+    return 1 if failed_packs else 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
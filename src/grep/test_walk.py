@@ -0,0 +1,132 @@
+#!/usr/bin/python3
+from __future__ import annotations
+from typing import TYPE_CHECKING, Dict, List, Sequence, Set, Tuple, cast
+
+if TYPE_CHECKING:
+    from _typeshed import StrPath
+
+import sys
+
+if sys.version_info < (3, 7):
+    raise Exception("python>=3.7 is required")
+
+import os
+import os.path
+import shutil
+import argparse
+import subprocess
+import logging
+
+
+logging.basicConfig(
+    level=os.getenv("LOG_LEVEL", "INFO"),
+    format="%(message)s",
+)
+
+logger = logging.getLogger("test")
+
+
+GREP_BIN = shutil.which("grep")
+
+if GREP_BIN is None:
+    raise FileNotFoundError("Unable to find grep binary in PATH")
+
+IGNORE_FILE = "test_walk_ignore.txt"
+
+# Paths under each searched directory which test_walk_ignore.txt hides,
+# GNU grep -r has no such option, so its output is filtered by these
+_IGNORED_FROM_ROOT = {
+    "a.log",
+    "root.txt",
+    "build/x.txt",
+    "docs/out/z.txt",
+    "docs/gen/n.txt",
+    "sub/a.log",
+    "sub/build/y.txt",
+}
+_IGNORED_FROM_SUB = {
+    "a.log",
+    "root.txt",
+    "build/y.txt",
+    "docs/gen/m.txt",
+}
+
+IGNORED: Dict[str, Set[str]] = {
+    "test_walk": {f"test_walk/{path}" for path in _IGNORED_FROM_ROOT},
+    "test_walk/sub": {f"test_walk/sub/{path}" for path in _IGNORED_FROM_SUB},
+}
+
+# Flags and directories searched with them
+CASES: List[Tuple[List[str], List[str]]] = [
+    (["needle"], ["test_walk"]),
+    (["-c", "needle"], ["test_walk/sub"]),
+    (["-l", "needle"], ["test_walk", "test_walk/sub"]),
+    (["-n", "-e", "sub", "-e", "log"], ["test_walk"]),
+]
+
+
+def _raise_if_not_exists(path: StrPath):
+    if not os.path.exists(path):
+        raise FileNotFoundError(f"Unable to find file with given path: {path!r}")
+
+
+def expected_lines(flags: Sequence[str], roots: Sequence[str]) -> List[bytes]:
+    """GNU grep -r output of each root without lines of ignored paths"""
+    lines: List[bytes] = []
+
+    for root in roots:
+        proc = subprocess.run(
+            [cast(str, GREP_BIN), "-E", "-r", *flags, root],
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+        )
+        for line in proc.stdout.splitlines():
+            if line.split(b":", 1)[0].decode() not in IGNORED[root]:
+                lines.append(line)
+
+    return sorted(lines)
+
+
+def check_case(test_bin: str, flags: Sequence[str], roots: Sequence[str]) -> bool:
+    proc = subprocess.run(
+        [test_bin, "-r", "--ignore-file", IGNORE_FILE, *flags, *roots],
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+    )
+
+    # Order of directory entries is up to the file system
+    got = sorted(proc.stdout.splitlines())
+    expected = expected_lines(flags, roots)
+
+    logger.debug(f"A: {expected!r}")
+    logger.debug(f"B: {got!r}")
+
+    return got == expected and proc.returncode == (0 if expected else 1)
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser()
+    parser.add_argument("test_bin")
+    args = parser.parse_args()
+    test_bin: str = args.test_bin
+
+    _raise_if_not_exists(test_bin)
+    _raise_if_not_exists(IGNORE_FILE)
+
+    failed_cases = []
+
+    for index, (flags, roots) in enumerate(CASES):
+        if not check_case(test_bin, flags, roots):
+            failed_cases.append((flags, roots))
+            logger.error(f"[{index+1:3}] FAILED {flags!r} {roots!r}")
+        else:
+            logger.info(f"[{index+1:3}] PASSED {flags!r} {roots!r}")
+
+    for flags, roots in failed_cases:
+        logger.info(f"FAILED: {(' '.join([*flags, *roots]))!r}")
+
+    return 1 if failed_cases else 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
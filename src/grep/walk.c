@@ -0,0 +1,500 @@
+#define _GNU_SOURCE
+#include "walk.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sstd/etc.h"
+
+// Glob chars which are taken literally but mean something in ERE
+#define GLOB_ERE_SPECIAL ".^$+(){}|\\[]*?"
+
+// Prepended to ignore rules without '/', they match at any depth
+#define GLOB_ANY_DIRS "(.*/)?"
+
+typedef struct {
+  const walk_t *walk;
+  walk_visit_t visit;
+  void *user_data;
+  char *path;
+  size_t path_size;
+  size_t path_capacity;
+  size_t root_size;  // Paths are relative to ignore files past that
+  rc_t rc;
+} walk_state_t;
+
+globset_t globset_init(void) {
+  return (globset_t){
+      .source = NULL,
+      .size = 0,
+      .capacity = 0,
+      .count = 0,
+      .iscompiled = false,
+  };
+}
+
+static void globset_append(globset_t *set, const char *s, size_t size) {
+  if (set->size + size + 1 > set->capacity) {
+    set->capacity = (set->size + size + 1) * 2;
+    set->source = realloc(set->source, set->capacity);
+  }
+
+  memcpy(set->source + set->size, s, size);
+  set->size += size;
+  set->source[set->size] = '\0';
+}
+
+/*
+ * :returns: Index of ']' closing bracket expression at `glob[start]` or 0
+ *           if it isn't closed, so '[' is taken literally
+ * */
+static size_t glob_bracket_end(const char *glob, size_t size, size_t start) {
+  size_t i = start + 1;
+
+  if (i < size && (glob[i] == '!' || glob[i] == '^')) {
+    ++i;
+  }
+  if (i < size && glob[i] == ']') {
+    ++i;
+  }
+
+  while (i < size && glob[i] != ']') {
+    if (glob[i] == '[' && i + 1 < size && glob[i + 1] == ':') {
+      const char *class_end = strstr(glob + i + 2, ":]");
+      i = class_end != NULL ? (size_t)(class_end - glob) + 2 : size;
+    } else {
+      ++i;
+    }
+  }
+
+  return i < size ? i : 0;
+}
+
+/*
+ * Appends `glob` converted to ERE as one more alternative. '*' and '?'
+ * don't match '/', "**" as a whole path component matches any number of
+ * them.
+ * */
+static void globset_push_converted(globset_t *set, const char *prefix,
+                                   const char *glob, size_t size) {
+  if (set->count > 0) {
+    globset_append(set, "|", 1);
+  }
+  globset_append(set, prefix, strlen(prefix));
+
+  for (size_t i = 0; i < size; ++i) {
+    bool iscomponent_start = i == 0 || glob[i - 1] == '/';
+    size_t bracket_end = 0;
+
+    if (glob[i] == '*' && i + 1 < size && glob[i + 1] == '*' &&
+        iscomponent_start && (i + 2 == size || glob[i + 2] == '/')) {
+      if (i + 2 == size) {
+        globset_append(set, ".*", 2);
+        i += 1;
+      } else {
+        globset_append(set, GLOB_ANY_DIRS, strlen(GLOB_ANY_DIRS));
+        i += 2;
+      }
+    } else if (glob[i] == '*') {
+      globset_append(set, "[^/]*", 5);
+    } else if (glob[i] == '?') {
+      globset_append(set, "[^/]", 4);
+    } else if (glob[i] == '[' &&
+               (bracket_end = glob_bracket_end(glob, size, i)) != 0) {
+      globset_append(set, "[", 1);
+      ++i;
+      if (glob[i] == '!' || glob[i] == '^') {
+        globset_append(set, "^", 1);
+        ++i;
+      }
+      globset_append(set, glob + i, bracket_end - i + 1);
+      i = bracket_end;
+    } else {
+      if (glob[i] == '\\' && i + 1 < size) {
+        ++i;
+      }
+      if (strchr(GLOB_ERE_SPECIAL, glob[i]) != NULL) {
+        globset_append(set, "\\", 1);
+      }
+      globset_append(set, glob + i, 1);
+    }
+  }
+
+  ++set->count;
+}
+
+void globset_push(globset_t *set, const char *glob) {
+  globset_push_converted(set, "", glob, strlen(glob));
+}
+
+static rc_t globset_compile(globset_t *set) {
+  rc_t rc = RC_OK;
+
+  if (set->count > 0) {
+    size_t size = set->size + sizeof("^()$");
+    char *regex_source = malloc(size);
+    snprintf(regex_source, size, "^(%s)$", set->source);
+
+    set->iscompiled = regcomp(&set->regex, regex_source,
+                              REG_EXTENDED | REG_NOSUB) == 0;
+    rc = set->iscompiled ? RC_OK : RC_ERROR;
+
+    free(regex_source);
+  }
+
+  return rc;
+}
+
+/*
+ * :returns: Whether `name` (not nullterminated) matches any glob of `set`,
+ *           always false for empty one
+ * */
+bool globset_match(const globset_t *set, const char *name, size_t size) {
+  regmatch_t bounds = {.rm_so = 0, .rm_eo = (regoff_t)size};
+  return set->iscompiled &&
+         regexec(&set->regex, name, 1, &bounds, REG_STARTEND) == 0;
+}
+
+void globset_free(globset_t *set) {
+  if (set->iscompiled) {
+    regfree(&set->regex);
+  }
+  free(set->source);
+  *set = globset_init();
+}
+
+walk_t walk_init(void) {
+  return (walk_t){
+      .include = globset_init(),
+      .exclude = globset_init(),
+      .exclude_dir = globset_init(),
+      .ignore = NULL,
+      .ignore_count = 0,
+      .max_filesize = 0,
+      .isrecursive = false,
+      .isquiet = false,
+  };
+}
+
+/*
+ * Adds one line of ignore file, the way .gitignore reads it: '!' negates,
+ * trailing '/' matches only directories, and rules with '/' elsewhere are
+ * anchored to the searched directory instead of matching at any depth.
+ * */
+static void walk_push_ignore_rule(walk_t *walk, char *rule, size_t size) {
+  bool isnegated = false, isdironly = false, isanchored = false;
+
+  while (size > 0 && (rule[size - 1] == ' ' || rule[size - 1] == '\r') &&
+         !(size > 1 && rule[size - 2] == '\\')) {
+    --size;
+  }
+
+  if (size > 0 && rule[0] == '!') {
+    isnegated = true;
+    ++rule;
+    --size;
+  }
+
+  if (size > 0 && rule[size - 1] == '/') {
+    isdironly = true;
+    --size;
+  }
+
+  if (memchr(rule, '/', size) != NULL) {
+    isanchored = true;
+  }
+  if (size > 0 && rule[0] == '/') {
+    ++rule;
+    --size;
+  }
+
+  if (size > 0) {
+    ignore_rules_t *last =
+        walk->ignore_count > 0 ? walk->ignore + walk->ignore_count - 1 : NULL;
+
+    if (last == NULL || last->isnegated != isnegated ||
+        last->isdironly != isdironly) {
+      walk->ignore =
+          realloc(walk->ignore, (walk->ignore_count + 1) * sizeof(*last));
+      last = walk->ignore + walk->ignore_count++;
+      *last = (ignore_rules_t){
+          .globs = globset_init(),
+          .isnegated = isnegated,
+          .isdironly = isdironly,
+      };
+    }
+
+    globset_push_converted(&last->globs, isanchored ? "" : GLOB_ANY_DIRS,
+                           rule, size);
+  }
+}
+
+rc_t walk_push_ignore_file(walk_t *walk, const char *file_path) {
+  rc_t rc = RC_OK;
+  FILE *file = fopen(file_path, "r");
+
+  if (file == NULL) {
+    rc = RC_FILE_NOT_FOUND;
+  } else {
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t line_size = 0;
+
+    while ((line_size = getline(&line, &line_capacity, file)) != RC_END) {
+      if (line_size > 0 && line[line_size - 1] == '\n') {
+        --line_size;
+      }
+      if (line_size > 0 && line[0] != '#') {
+        walk_push_ignore_rule(walk, line, line_size);
+      }
+    }
+
+    free(line);
+    fclose(file);
+  }
+
+  return rc;
+}
+
+rc_t walk_compile(walk_t *walk) {
+  rc_t rc = RC_OK;
+
+  if (globset_compile(&walk->include) != RC_OK ||
+      globset_compile(&walk->exclude) != RC_OK ||
+      globset_compile(&walk->exclude_dir) != RC_OK) {
+    rc = RC_ERROR;
+  }
+
+  for (size_t i = 0; rc == RC_OK && i < walk->ignore_count; ++i) {
+    rc = globset_compile(&walk->ignore[i].globs);
+  }
+
+  return rc;
+}
+
+void walk_free(walk_t *walk) {
+  globset_free(&walk->include);
+  globset_free(&walk->exclude);
+  globset_free(&walk->exclude_dir);
+
+  for (size_t i = 0; i < walk->ignore_count; ++i) {
+    globset_free(&walk->ignore[i].globs);
+  }
+  free(walk->ignore);
+
+  *walk = walk_init();
+}
+
+static bool walk_isignored(const walk_t *walk, const char *relpath,
+                           bool isdir) {
+  size_t size = strlen(relpath);
+
+  for (size_t i = walk->ignore_count; i > 0; --i) {
+    const ignore_rules_t *rules = walk->ignore + i - 1;
+
+    if ((!rules->isdironly || isdir) &&
+        globset_match(&rules->globs, relpath, size)) {
+      return !rules->isnegated;
+    }
+  }
+
+  return false;
+}
+
+static bool walk_skips_file(const walk_t *walk, const char *name,
+                            size_t name_size) {
+  return globset_match(&walk->exclude, name, name_size) ||
+         (walk->include.count > 0 &&
+          !globset_match(&walk->include, name, name_size));
+}
+
+static bool walk_istoo_big(const walk_t *walk, const struct stat *st) {
+  return walk->max_filesize > 0 && S_ISREG(st->st_mode) &&
+         (unsigned long long)st->st_size > walk->max_filesize;
+}
+
+static void walk_report(walk_state_t *state, const char *path) {
+  if (!state->walk->isquiet) {
+    fprintf(stderr, "error: %s: %s\n", path, strerror(errno));
+  }
+  state->rc = RC_ERROR;
+}
+
+static void walk_path_push(walk_state_t *state, const char *name) {
+  size_t name_size = strlen(name);
+  bool needs_slash =
+      state->path_size > 0 && state->path[state->path_size - 1] != '/';
+  size_t size = state->path_size + needs_slash + name_size + 1;
+
+  if (size > state->path_capacity) {
+    state->path_capacity = size * 2;
+    state->path = realloc(state->path, state->path_capacity);
+  }
+
+  if (needs_slash) {
+    state->path[state->path_size++] = '/';
+  }
+  memcpy(state->path + state->path_size, name, name_size + 1);
+  state->path_size += name_size;
+}
+
+/*
+ * Visits everything under directory `dir_fd` (taken over and closed) which
+ * is at `state->path`. Symbolic links and special files met on the way are
+ * skipped, same as GNU grep -r does.
+ * */
+static void walk_dir(walk_state_t *state, int dir_fd) {
+  const walk_t *walk = state->walk;
+  DIR *dir = fdopendir(dir_fd);
+
+  if (dir == NULL) {
+    walk_report(state, state->path);
+    close(dir_fd);
+    return;
+  }
+
+  size_t dir_path_size = state->path_size;
+  struct dirent *entry = NULL;
+
+  while ((entry = readdir(dir)) != NULL) {
+    const char *name = entry->d_name;
+    size_t name_size = strlen(name);
+    unsigned char type = entry->d_type;
+    struct stat st;
+    bool hasstat = false;
+
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+      continue;
+    }
+
+    if (type == DT_UNKNOWN) {
+      hasstat = fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+      type = !hasstat              ? DT_UNKNOWN
+             : S_ISDIR(st.st_mode) ? DT_DIR
+             : S_ISREG(st.st_mode) ? DT_REG
+                                   : DT_UNKNOWN;
+    }
+
+    bool isdir = type == DT_DIR;
+
+    if (!(isdir || type == DT_REG) ||
+        (isdir ? globset_match(&walk->exclude_dir, name, name_size)
+               : walk_skips_file(walk, name, name_size))) {
+      continue;
+    }
+
+    walk_path_push(state, name);
+    const char *relpath = state->path + state->root_size;
+    if (*relpath == '/') {
+      ++relpath;
+    }
+
+    if (walk_isignored(walk, relpath, isdir)) {
+      // Skip it
+    } else if (isdir) {
+      int subdir_fd = openat(dirfd(dir), name,
+                             O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if (subdir_fd == -1) {
+        walk_report(state, state->path);
+      } else {
+        walk_dir(state, subdir_fd);
+      }
+    } else if (walk->max_filesize > 0 && !hasstat &&
+               fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+      walk_report(state, state->path);
+    } else if (!walk_istoo_big(walk, &st)) {
+      state->visit(dirfd(dir), name, state->path, state->user_data);
+    }
+
+    state->path_size = dir_path_size;
+    state->path[dir_path_size] = '\0';
+  }
+
+  closedir(dir);
+}
+
+static void walk_root(walk_state_t *state, const char *path,
+                      const char *shown_path) {
+  int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  state->path_size = 0;
+  walk_path_push(state, shown_path);
+  state->root_size = state->path_size;
+
+  if (dir_fd == -1) {
+    walk_report(state, path);
+  } else {
+    walk_dir(state, dir_fd);
+  }
+}
+
+/*
+ * :returns: Last component of `path` ignoring trailing '/'s, it's size is
+ *           put to `size`
+ * */
+static const char *path_basename(const char *path, size_t *size) {
+  size_t end = strlen(path);
+
+  while (end > 1 && path[end - 1] == '/') {
+    --end;
+  }
+
+  size_t start = end;
+  while (start > 0 && path[start - 1] != '/') {
+    --start;
+  }
+
+  *size = end - start;
+  return path + start;
+}
+
+rc_t walk_paths(const walk_t *walk, char *const *paths, size_t count,
+                walk_visit_t visit, void *user_data) {
+  walk_state_t state = {
+      .walk = walk,
+      .visit = visit,
+      .user_data = user_data,
+      .path = NULL,
+      .path_size = 0,
+      .path_capacity = 0,
+      .root_size = 0,
+      .rc = RC_OK,
+  };
+
+  if (count == 0 && walk->isrecursive) {
+    walk_root(&state, ".", "");
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    const char *path = paths[i];
+    size_t name_size = 0;
+    const char *name = path_basename(path, &name_size);
+    struct stat st;
+    // Missing paths go to `visit` as is, it knows how to complain
+    bool hasstat = (walk->isrecursive || walk->max_filesize > 0) &&
+                   stat(path, &st) == 0;
+
+    if (hasstat && walk->isrecursive && S_ISDIR(st.st_mode)) {
+      if (!globset_match(&walk->exclude_dir, name, name_size)) {
+        walk_root(&state, path, path);
+      }
+    } else if (walk_skips_file(walk, name, name_size) ||
+               (hasstat && walk_istoo_big(walk, &st))) {
+      // Skip it
+    } else {
+      visit(AT_FDCWD, path, path, user_data);
+    }
+  }
+
+  free(state.path);
+
+  return state.rc;
+}
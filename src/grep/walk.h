@@ -0,0 +1,80 @@
+#ifndef GREP_WALK_H_
+#define GREP_WALK_H_
+
+/*
+ * Picks files to search out of command line arguments and, with -r, out of
+ * directories under them.
+ *
+ * Everything is decided by name before a file is opened. Globs of every
+ * kind are compiled into one regex, so a name is tested against all
+ * --include (or --exclude, ...) globs with a single `regexec`. Directory
+ * entries are told apart by `d_type`, so only --max-filesize and file
+ * systems which don't fill it in cost a `fstatat`.
+ * */
+
+#include <regex.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "rc.h"
+
+typedef struct {
+  char *source;  // Converted globs joined with '|'
+  size_t size;
+  size_t capacity;
+  size_t count;
+  regex_t regex;
+  bool iscompiled;
+} globset_t;
+
+/*
+ * Consecutive rules of ignore file which have the same kind, rules are
+ * looked at from the last one and the first matching decides.
+ * */
+typedef struct {
+  globset_t globs;
+  bool isnegated;
+  bool isdironly;
+} ignore_rules_t;
+
+typedef struct {
+  globset_t include;
+  globset_t exclude;
+  globset_t exclude_dir;
+  ignore_rules_t *ignore;
+  size_t ignore_count;
+  size_t max_filesize;  // 0 means any size
+  bool isrecursive;
+  bool isquiet;
+} walk_t;
+
+/*
+ * Called for every file left after filtering. `name` is relative to
+ * `dir_fd` (AT_FDCWD for command line arguments), `path` is how the file
+ * should be shown.
+ * */
+typedef void (*walk_visit_t)(int dir_fd, const char *name, const char *path,
+                             void *user_data);
+
+globset_t globset_init(void);
+void globset_push(globset_t *set, const char *glob);
+bool globset_match(const globset_t *set, const char *name, size_t size);
+void globset_free(globset_t *set);
+
+walk_t walk_init(void);
+rc_t walk_push_ignore_file(walk_t *walk, const char *file_path);
+rc_t walk_compile(walk_t *walk);
+void walk_free(walk_t *walk);
+
+/*
+ * Calls `visit` for every one of `paths` and, with `walk->isrecursive`, for
+ * files under the ones which are directories (or under "." if there are no
+ * `paths`). Arguments which can't be looked at are passed on as is, so
+ * `visit` reports them the same way as without filters.
+ *
+ * :returns: RC_ERROR if some directory can't be read
+ * */
+rc_t walk_paths(const walk_t *walk, char *const *paths, size_t count,
+                walk_visit_t visit, void *user_data);
+
+#endif  // GREP_WALK_H_